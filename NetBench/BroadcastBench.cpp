@@ -0,0 +1,131 @@
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <blcl_net.h>
+
+// Measures the CPU cost of fanning one state update, of 60 or 1000 bytes, out to N loopback connections,
+// copying it into every write queue versus sharing one immutable payload. The fan-out, up to the message sitting in
+// every write queue, is timed apart from the socket writes that follow, which cost the same either way.
+enum class MsgType: uint32_t {
+    ServerMessage
+};
+
+constexpr int ROUNDS = 41;
+
+class bench_connection: public blcl::net::connection<MsgType> {
+public:
+    using blcl::net::connection<MsgType>::connection;
+
+    void mark_validated() {
+        validated_ = true;
+    }
+
+    // While held, the connection sees a write in flight and leaves what is sent in the queue.
+    // The next send() after release_writes() writes out everything queued meanwhile.
+    void hold_writes(bool held) {
+        writing_ = held;
+    }
+};
+
+class bench_server: public blcl::net::server_interface<MsgType> {
+public:
+    bench_server(): blcl::net::server_interface<MsgType>(0, 1) {
+
+    }
+
+    ~bench_server() override {
+        stop();
+    }
+
+    void add_clients(size_t count) {
+        asio::io_context& context = *io_contexts_.front();
+        auto endpoint = asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), asio_acceptor_.local_endpoint().port());
+        for (size_t i = 0; i < count; i++) {
+            peers_.emplace_back(context);
+            peers_.back().connect(endpoint);
+            auto conn = std::make_shared<bench_connection>(
+                    blcl::net::connection<MsgType>::owner::server, context, asio_acceptor_.accept(context), shards_.front()->incoming_messages);
+            conn->mark_validated();
+            connections_.push_back(conn);
+            shards_.front()->connections.insert(std::move(conn));
+        }
+    }
+
+    // Runs every handler posted so far on the calling thread.
+    void poll() {
+        auto& context = *io_contexts_.front();
+        context.restart();
+        context.poll();
+    }
+
+    struct timing {
+        std::vector<double> fan_out_us;
+        std::vector<double> write_us;
+    };
+
+    // Times fn() together with the handlers that queue what it sent, then, separately, the writes of it.
+    template <typename Fn>
+    void time_round(timing& t, Fn&& fn) {
+        using clock = std::chrono::steady_clock;
+        for (auto& conn: connections_)
+            conn->hold_writes(true);
+        auto start = clock::now();
+        fn();
+        poll();
+        auto queued = clock::now();
+        for (auto& conn: connections_) {
+            conn->hold_writes(false);
+            conn->send(kick_);
+        }
+        poll();
+        t.fan_out_us.push_back(std::chrono::duration<double, std::micro>(queued - start).count());
+        t.write_us.push_back(std::chrono::duration<double, std::micro>(clock::now() - queued).count());
+    }
+
+    static double median(std::vector<double> v) {
+        std::sort(v.begin(), v.end());
+        return v[v.size() / 2];
+    }
+
+    void run(size_t clients, size_t body_size) {
+        add_clients(clients - shards_.front()->connections.size());
+
+        blcl::net::message<MsgType> msg;
+        msg.header.id = MsgType::ServerMessage;
+        std::vector<uint8_t> state(body_size);
+        msg.body.assign(state.begin(), state.end());
+        msg.header.size = msg.size();
+
+        // Alternated round by round, so that both see the same state of the heap and the caches.
+        timing copied, shared;
+        for (int i = 0; i < ROUNDS; i++) {
+            time_round(copied, [&]() {
+                for (auto& client: shards_.front()->connections)
+                    client->send(msg);
+            });
+            time_round(shared, [&]() {
+                broadcast_message(msg);
+            });
+        }
+
+        std::cout << "clients=" << clients << " body=" << body_size
+                  << " fan-out: copied=" << median(copied.fan_out_us) << " us shared=" << median(shared.fan_out_us) << " us"
+                  << " | writes: copied=" << median(copied.write_us) << " us shared=" << median(shared.write_us) << " us\n";
+    }
+
+private:
+    std::deque<asio::ip::tcp::socket> peers_;
+    std::vector<std::shared_ptr<bench_connection>> connections_;
+    // An empty message that gets held writes going again.
+    blcl::net::shared_message<MsgType> kick_ = blcl::net::make_shared_message(blcl::net::message<MsgType> {});
+};
+
+int main() {
+    bench_server server;
+    for (size_t clients: { 10, 100, 1000, 2000, 5000 }) {
+        for (size_t body_size: { 60, 1000 })
+            server.run(clients, body_size);
+    }
+
+    return 0;
+}
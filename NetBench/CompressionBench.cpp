@@ -0,0 +1,195 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <string>
+#include <blcl_net.h>
+
+// Measures the bundled LZ codec on the kinds of large bodies we send: world-state blobs, chat history,
+// and incompressible data that compress_message should refuse. Then echoes world-state blobs over loopback
+// with and without enable_compression() and compares the bytes the server put on the wire.
+
+enum class MsgType: uint32_t {
+    ServerAccept,
+    WorldState
+};
+
+struct Vector {
+    float x; float y; float z;
+    static constexpr auto schema = blcl::net::schema_fields(&Vector::x, &Vector::y, &Vector::z);
+};
+struct Quad {
+    float x; float y; float z; float w;
+    static constexpr auto schema = blcl::net::schema_fields(&Quad::x, &Quad::y, &Quad::z, &Quad::w);
+};
+struct State {
+    uint32_t type;
+    Vector pos;
+    Quad rot;
+    static constexpr auto schema = blcl::net::schema_fields(&State::type, &State::pos, &State::rot);
+};
+
+using message = blcl::net::message<MsgType>;
+
+message world_state(size_t entities, std::mt19937& rng) {
+    std::uniform_int_distribution<int> cell(-64, 64);
+    std::uniform_int_distribution<uint32_t> type(0, 3);
+    message msg;
+    msg.header.id = MsgType::WorldState;
+    for (size_t i = 0; i < entities; i++) {
+        // Positions snap to a half-unit grid and most entities are upright, as in a typical level.
+        State s { type(rng), { cell(rng) * 0.5f, 0.0f, cell(rng) * 0.5f }, { 0.0f, 0.0f, 0.0f, 1.0f } };
+        msg.write(s);
+    }
+    return msg;
+}
+
+message chat_history(size_t bytes, std::mt19937& rng) {
+    static const char* names[] = { "alice", "bob", "carol", "dave", "eve" };
+    static const char* words[] = { "anyone", "up", "for", "a", "raid", "tonight", "need", "healer", "gg", "wp",
+                                   "lag", "again", "meet", "at", "the", "north", "gate", "in", "five", "minutes" };
+    std::string text;
+    while (text.size() < bytes) {
+        text += "[12:";
+        text += std::to_string(10 + rng() % 50);
+        text += "] ";
+        text += names[rng() % 5];
+        text += ":";
+        for (int w = 0, n = 3 + int(rng() % 8); w < n; w++) {
+            text += " ";
+            text += words[rng() % 20];
+        }
+        text += "\n";
+    }
+    message msg;
+    msg.header.id = MsgType::WorldState;
+    msg.body.assign(text.begin(), text.begin() + bytes);
+    msg.header.size = msg.size();
+    return msg;
+}
+
+message random_bytes(size_t bytes, std::mt19937& rng) {
+    message msg;
+    msg.header.id = MsgType::WorldState;
+    msg.body.resize(bytes);
+    for (auto& b: msg.body)
+        b = uint8_t(rng());
+    msg.header.size = msg.size();
+    return msg;
+}
+
+void measure(const char* name, const message& msg) {
+    constexpr int ROUNDS = 200;
+    message packed;
+    bool paid_off = blcl::net::compress_message(msg, packed);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; i++) {
+        message out;
+        blcl::net::compress_message(msg, out);
+    }
+    auto compressed_at = std::chrono::steady_clock::now();
+    message unpacked;
+    bool ok = true;
+    if (paid_off) {
+        for (int i = 0; i < ROUNDS; i++)
+            ok &= blcl::net::decompress_body(packed.body.data(), packed.body.size(), unpacked);
+        ok &= unpacked.body == msg.body;
+    }
+    auto decompressed_at = std::chrono::steady_clock::now();
+
+    std::cout << name << " size=" << msg.size()
+              << " compressed=" << (paid_off ? packed.size() : msg.size())
+              << " ratio=" << (paid_off ? double(msg.size()) / packed.size() : 1.0) << "x"
+              << (paid_off ? "" : " (skipped)")
+              << " compress=" << std::chrono::duration<double, std::micro>(compressed_at - start).count() / ROUNDS << " us/msg"
+              << " decompress=" << std::chrono::duration<double, std::micro>(decompressed_at - compressed_at).count() / ROUNDS << " us/msg"
+              << (ok ? "" : " MISMATCH") << "\n";
+}
+
+class echo_server: public blcl::net::server_interface<MsgType> {
+public:
+    using server_interface::server_interface;
+
+    ~echo_server() override {
+        stop();
+    }
+
+    uint64_t written_bytes() {
+        std::scoped_lock lock(mtx_);
+        return client_ ? client_->get_stats().bytes_out : 0;
+    }
+
+protected:
+    bool on_client_connect(std::shared_ptr<blcl::net::connection<MsgType>> c) override {
+        return true;
+    }
+
+    void on_client_validated(std::shared_ptr<blcl::net::connection<MsgType>> c) override {
+        std::scoped_lock lock(mtx_);
+        client_ = c;
+    }
+
+    void on_message(std::shared_ptr<blcl::net::connection<MsgType>> c, message& msg) override {
+        c->send(std::move(msg));
+    }
+
+private:
+    std::mutex mtx_;
+    std::shared_ptr<blcl::net::connection<MsgType>> client_;
+};
+
+// Echoes count copies of msg and returns the bytes the server wrote, or 0 if an echo came back altered.
+uint64_t echo(uint16_t port, bool compression, const message& msg, int count) {
+    echo_server server(port, 1);
+    if (compression)
+        server.enable_compression();
+    server.start();
+    std::atomic<bool> running = true;
+    std::thread update_thread([&]() { while (running) server.update(-1, false); });
+
+    blcl::net::client_interface<MsgType> client;
+    if (compression)
+        client.enable_compression();
+    client.connect("127.0.0.1", port);
+    while (!client.is_connected())
+        std::this_thread::yield();
+    for (int i = 0; i < count; i++)
+        client.send(msg);
+
+    int received = 0;
+    bool intact = true;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (received < count && std::chrono::steady_clock::now() < deadline) {
+        if (client.get_incoming_messages().empty()) {
+            std::this_thread::yield();
+            continue;
+        }
+        auto in = client.get_incoming_messages().pop_front().msg;
+        intact &= in.body == msg.body && in.header.size == msg.header.size;
+        received++;
+    }
+
+    uint64_t bytes = server.written_bytes();
+    client.disconnect();
+    running = false;
+    update_thread.join();
+    server.stop();
+    return intact && received == count ? bytes : 0;
+}
+
+int main() {
+    std::mt19937 rng(3);
+    for (size_t entities: { 32, 128, 512, 2048 })
+        measure(("world_state/" + std::to_string(entities)).c_str(), world_state(entities, rng));
+    for (size_t bytes: { 1024, 4096, 16384, 65536 })
+        measure(("chat_history/" + std::to_string(bytes)).c_str(), chat_history(bytes, rng));
+    measure("random/4096", random_bytes(4096, rng));
+
+    auto blob = world_state(512, rng);
+    uint64_t plain = echo(60140, false, blob, 200);
+    uint64_t packed = echo(60141, true, blob, 200);
+    std::cout << "loopback echo of 200 x " << blob.size() << " B: server wrote " << plain << " B plain, "
+              << packed << " B compressed" << (plain && packed ? "" : " (FAILED)") << "\n";
+
+    return plain && packed ? 0 : 1;
+}
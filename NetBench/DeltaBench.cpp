@@ -0,0 +1,156 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <cstddef>
+#include <blcl_net.h>
+
+// Replays a fixed corpus of entity trajectories through delta_encoder/delta_decoder over a simulated link
+// with loss on both the updates and the acks, and an ack delay of a few ticks.
+// Checks every applied state against the quantized ground truth, then reports bytes per update against
+// sending the raw State, and encode/decode time per update.
+
+struct Vector {
+    float x; float y; float z;
+};
+struct Quad {
+    float x; float y; float z; float w;
+};
+
+struct State {
+    uint32_t type;
+    Vector pos;
+    Quad rot;
+};
+
+enum class MsgType: uint32_t {
+    StateUpdate
+};
+
+constexpr int ENTITIES = 256;
+constexpr int TICKS = 600;
+constexpr int ACK_DELAY = 3;
+
+// Entity kinds in the corpus: most stand still, some walk and turn now and then, a few spin every tick,
+// and some teleport occasionally.
+std::vector<std::vector<State>> make_corpus() {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> place(-2000.0f, 2000.0f);
+    std::uniform_real_distribution<float> step(-0.2f, 0.2f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    std::vector<std::vector<State>> corpus(ENTITIES);
+    for (int e = 0; e < ENTITIES; e++) {
+        int kind = e % 8 < 4 ? 0 : e % 8 < 6 ? 1 : e % 8 < 7 ? 2 : 3;
+        State s { uint32_t(kind), { place(rng), 0.0f, place(rng) }, { 0.0f, 0.0f, 0.0f, 1.0f } };
+        float angle = 0;
+        for (int t = 0; t < TICKS; t++) {
+            if (kind == 1) {
+                s.pos.x += step(rng);
+                s.pos.z += step(rng);
+                if (unit(rng) < 0.1f)
+                    angle += step(rng);
+            } else if (kind == 2) {
+                angle += 0.05f;
+            } else if (kind == 3 && unit(rng) < 0.02f) {
+                s.pos = { place(rng), 0.0f, place(rng) };
+            }
+            s.rot = { 0.0f, std::sin(angle / 2), 0.0f, std::cos(angle / 2) };
+            corpus[e].push_back(s);
+        }
+    }
+    return corpus;
+}
+
+int main() {
+    auto corpus = make_corpus();
+    auto schema = blcl::net::delta_schema<State>()
+            .quantize(offsetof(State, pos), 3, 1.0f / 256)
+            .quantize(offsetof(State, rot), 4, 1.0f / 4096);
+    const size_t raw_bytes = sizeof(blcl::net::message_header<MsgType>) + sizeof(State);
+
+    for (double loss: { 0.0, 0.05, 0.2 }) {
+        std::mt19937 rng(11);
+        std::bernoulli_distribution lost(loss);
+
+        uint64_t updates = 0, delivered = 0, bytes = 0, resyncs = 0, mismatches = 0;
+        for (int e = 0; e < ENTITIES; e++) {
+            blcl::net::delta_encoder<State> encoder(schema);
+            blcl::net::delta_decoder<State> decoder(schema);
+            std::vector<std::pair<int, uint16_t>> acks;
+            bool resync = false;
+
+            for (int t = 0; t < TICKS; t++) {
+                for (auto it = acks.begin(); it != acks.end() && it->first <= t; it = acks.erase(it))
+                    encoder.ack(it->second);
+                if (resync) {
+                    encoder.reset();
+                    resync = false;
+                }
+
+                blcl::net::message<MsgType> msg;
+                msg.header.id = MsgType::StateUpdate;
+                encoder.encode(corpus[e][t], msg);
+                updates++;
+                bytes += sizeof(msg.header) + msg.size();
+                if (lost(rng))
+                    continue;
+
+                State state;
+                auto status = decoder.decode(msg, state);
+                if (status == blcl::net::delta_status::missing_baseline) {
+                    resyncs++;
+                    resync = true;
+                    continue;
+                }
+                if (status != blcl::net::delta_status::applied) {
+                    mismatches++;
+                    continue;
+                }
+                delivered++;
+                auto expected = schema.from_fields(schema.to_fields(corpus[e][t]));
+                if (std::memcmp(&state, &expected, sizeof(State)) != 0)
+                    mismatches++;
+                if (!lost(rng))
+                    acks.emplace_back(t + ACK_DELAY, decoder.last_sequence());
+            }
+        }
+
+        std::cout << "loss=" << loss * 100 << "%"
+                  << " delivered=" << delivered << "/" << updates
+                  << " raw=" << raw_bytes << " B/update"
+                  << " delta=" << double(bytes) / updates << " B/update"
+                  << " ratio=" << raw_bytes / (double(bytes) / updates) << "x"
+                  << " resyncs=" << resyncs
+                  << " mismatches=" << mismatches << "\n";
+        if (mismatches != 0)
+            return 1;
+    }
+
+    // Timing, lossless with immediate acks so the steady-state delta path is what gets measured.
+    std::vector<blcl::net::message<MsgType>> encoded;
+    encoded.reserve(size_t(ENTITIES) * TICKS);
+    auto start = std::chrono::steady_clock::now();
+    for (int e = 0; e < ENTITIES; e++) {
+        blcl::net::delta_encoder<State> encoder(schema);
+        for (int t = 0; t < TICKS; t++) {
+            auto& msg = encoded.emplace_back();
+            encoder.ack(encoder.encode(corpus[e][t], msg));
+        }
+    }
+    auto encoded_at = std::chrono::steady_clock::now();
+    uint64_t applied = 0;
+    for (int e = 0; e < ENTITIES; e++) {
+        blcl::net::delta_decoder<State> decoder(schema);
+        State state;
+        for (int t = 0; t < TICKS; t++)
+            applied += decoder.decode(encoded[size_t(e) * TICKS + t], state) == blcl::net::delta_status::applied;
+    }
+    auto decoded_at = std::chrono::steady_clock::now();
+
+    double n = double(ENTITIES) * TICKS;
+    std::cout << "encode=" << std::chrono::duration<double, std::nano>(encoded_at - start).count() / n << " ns/update"
+              << " decode=" << std::chrono::duration<double, std::nano>(decoded_at - encoded_at).count() / n << " ns/update"
+              << " applied=" << applied << "/" << uint64_t(n) << "\n";
+
+    return applied == uint64_t(n) ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <blcl_net.h>
+
+// Two parts of accepting a client.
+// Admission: the cost of deciding whether to let an address in, from several accept threads at once, for
+// admission_controller against a string-keyed map behind a mutex, which is how SimpleServer used to do it.
+// Handshake: the time from client_interface::connect() until the first message each side queued right away
+// (the client before its connection is even up, the server in on_client_connect) reaches the other side.
+
+enum class MsgType: uint32_t {
+    ServerAccept,
+    Hello
+};
+
+using clock_type = std::chrono::steady_clock;
+constexpr size_t ADMISSIONS_PER_THREAD = 500'000;
+constexpr size_t ADDRESSES = 4096;
+
+class string_counter {
+public:
+    bool admit(const asio::ip::address& address) {
+        std::scoped_lock lock(mtx_);
+        return ++counts_[address.to_string()] <= 10;
+    }
+
+private:
+    std::mutex mtx_;
+    std::unordered_map<std::string, uint64_t> counts_;
+};
+
+template <typename Counter>
+double admissions_per_second(Counter& counter, const std::vector<asio::ip::address>& addresses, size_t threads) {
+    std::atomic<size_t> admitted = 0;
+    auto start = clock_type::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            size_t n = 0;
+            for (size_t i = 0; i < ADMISSIONS_PER_THREAD; i++)
+                n += counter.admit(addresses[(i * 7 + t) % addresses.size()]);
+            admitted += n;
+        });
+    }
+    for (auto& w: workers)
+        w.join();
+    double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+    return double(ADMISSIONS_PER_THREAD * threads) / elapsed;
+}
+
+class handshake_server: public blcl::net::server_interface<MsgType> {
+public:
+    explicit handshake_server(uint16_t port): server_interface(port, 1) {
+
+    }
+
+    ~handshake_server() override {
+        stop();
+    }
+
+    std::atomic<int64_t> first_message { 0 };
+
+protected:
+    bool on_client_connect(std::shared_ptr<blcl::net::connection<MsgType>> c) override {
+        blcl::net::message<MsgType> msg;
+        msg.header.id = MsgType::ServerAccept;
+        c->send(std::move(msg));
+        return true;
+    }
+
+    void on_message(std::shared_ptr<blcl::net::connection<MsgType>> c, blcl::net::message<MsgType>& msg) override {
+        first_message = clock_type::now().time_since_epoch().count();
+    }
+};
+
+double percentile(std::vector<double>& v, double p) {
+    if (v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, size_t(p * v.size()))];
+}
+
+int main() {
+    std::vector<asio::ip::address> addresses;
+    for (uint32_t i = 0; i < ADDRESSES; i++)
+        addresses.push_back(asio::ip::address_v4(0x0A000000u + i * 2654435761u % 0xFFFFFF));
+
+    for (size_t threads: { 1, 4 }) {
+        string_counter strings;
+        blcl::net::admission_controller sketch(10, std::chrono::minutes(1));
+        std::cout << "admission threads=" << threads
+                  << " string map=" << uint64_t(admissions_per_second(strings, addresses, threads)) << "/s"
+                  << " sketch=" << uint64_t(admissions_per_second(sketch, addresses, threads)) << "/s\n";
+    }
+
+    constexpr uint16_t PORT = 60160;
+    constexpr int CONNECTS = 300;
+    handshake_server server(PORT);
+    server.enable_inline_dispatch();
+    server.start();
+    std::vector<double> to_server, to_client;
+    for (int i = 0; i < CONNECTS; i++) {
+        server.first_message = 0;
+        blcl::net::client_interface<MsgType> client;
+        auto start = clock_type::now();
+        client.connect("127.0.0.1", PORT);
+        blcl::net::message<MsgType> hello;
+        hello.header.id = MsgType::Hello;
+        client.send(hello);
+
+        auto deadline = start + std::chrono::seconds(2);
+        bool answered = false;
+        while (clock_type::now() < deadline && (!answered || server.first_message == 0)) {
+            // Polling without yielding starves the I/O threads on a machine with few cores.
+            std::this_thread::yield();
+            if (!answered && !client.get_incoming_messages().empty()) {
+                answered = true;
+                to_client.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - start).count());
+            }
+        }
+        if (server.first_message != 0)
+            to_server.push_back((server.first_message - start.time_since_epoch().count()) / 1000.0);
+        client.disconnect();
+    }
+    server.stop();
+
+    std::cout << "handshake connects=" << CONNECTS
+              << " client->server p50=" << percentile(to_server, 0.5) << " us p90=" << percentile(to_server, 0.9) << " us"
+              << " server->client p50=" << percentile(to_client, 0.5) << " us p90=" << percentile(to_client, 0.9) << " us\n";
+    return to_server.size() == CONNECTS && to_client.size() == CONNECTS ? 0 : 1;
+}
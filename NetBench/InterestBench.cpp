@@ -0,0 +1,55 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <blcl_net.h>
+
+// Simulates N clients wandering a 4 km x 4 km map, each sending one state update per tick.
+// Compares messages sent per tick by broadcast_message (everyone) against broadcast_nearby,
+// and times the incremental index update plus the range queries.
+constexpr float WORLD_SIZE = 4000.0f;
+constexpr float RADIUS = 150.0f;
+constexpr int TICKS = 20;
+
+int main() {
+    for (size_t clients: { 1000, 5000, 10000 }) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> place(0.0f, WORLD_SIZE);
+        std::uniform_real_distribution<float> step(-5.0f, 5.0f);
+
+        blcl::net::spatial_grid<uint32_t> grid(RADIUS);
+        std::vector<blcl::net::vec3> positions(clients);
+        for (uint32_t i = 0; i < clients; i++) {
+            positions[i] = { place(rng), 0.0f, place(rng) };
+            grid.update(i, i, positions[i]);
+        }
+
+        uint64_t sent = 0;
+        double update_us = 0, query_us = 0;
+        for (int tick = 0; tick < TICKS; tick++) {
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < clients; i++) {
+                positions[i].x += step(rng);
+                positions[i].z += step(rng);
+                grid.update(i, i, positions[i]);
+            }
+            auto updated = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < clients; i++) {
+                grid.query(positions[i], RADIUS, [&](uint32_t key, uint32_t, const blcl::net::vec3&) {
+                    if (key != i)
+                        sent++;
+                });
+            }
+            auto queried = std::chrono::steady_clock::now();
+            update_us += std::chrono::duration<double, std::micro>(updated - start).count();
+            query_us += std::chrono::duration<double, std::micro>(queried - updated).count();
+        }
+
+        std::cout << "clients=" << clients
+                  << " broadcast_msgs/tick=" << uint64_t(clients) * (clients - 1)
+                  << " nearby_msgs/tick=" << sent / TICKS
+                  << " index_update=" << update_us / TICKS << " us/tick"
+                  << " queries=" << query_us / TICKS << " us/tick\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <blcl_net.h>
+
+// Ping round trips to a client whose connection is saturated with bulk traffic. The server keeps a backlog of
+// bulk-lane messages queued to the client and answers pings either on the bulk lane too, which is a plain FIFO queue,
+// or on the high lane, where a pong only waits for the batch in flight, not for the backlog ahead of it. Both still wait for
+// whatever the kernel socket buffers hold, which no lane can reorder. The client takes everything queued for it on each
+// pass, so its own incoming queue adds next to nothing. Fails unless every ping is answered and the high lane wins.
+
+enum class MsgType: uint32_t {
+    ServerAccept,
+    ServerPing,
+    Bulk
+};
+
+using message = blcl::net::message<MsgType>;
+using clock_type = std::chrono::steady_clock;
+
+class bulk_server: public blcl::net::server_interface<MsgType> {
+public:
+    bulk_server(uint16_t port, blcl::net::priority ping_lane): server_interface(port, 1), ping_lane_(ping_lane) {
+
+    }
+
+    ~bulk_server() override {
+        stop();
+    }
+
+    // Tops the client's outgoing queue back up to backlog messages.
+    void feed(size_t backlog, const message& bulk) {
+        std::scoped_lock lock(mtx_);
+        if (!client_)
+            return;
+        for (size_t depth = client_->get_stats().outgoing_queue_depth; depth < backlog; depth++)
+            client_->send(bulk, blcl::net::priority::bulk);
+    }
+
+    blcl::net::connection_stats client_stats() {
+        std::scoped_lock lock(mtx_);
+        return client_ ? client_->get_stats() : blcl::net::connection_stats {};
+    }
+
+protected:
+    bool on_client_connect(std::shared_ptr<blcl::net::connection<MsgType>> c) override {
+        return true;
+    }
+
+    void on_client_validated(std::shared_ptr<blcl::net::connection<MsgType>> c) override {
+        std::scoped_lock lock(mtx_);
+        client_ = c;
+    }
+
+    void on_message(std::shared_ptr<blcl::net::connection<MsgType>> c, message& msg) override {
+        if (msg.header.id == MsgType::ServerPing)
+            c->send(std::move(msg), ping_lane_);
+    }
+
+private:
+    blcl::net::priority ping_lane_;
+    std::mutex mtx_;
+    std::shared_ptr<blcl::net::connection<MsgType>> client_;
+};
+
+struct result {
+    std::vector<double> rtt_us;
+    uint64_t bulk_received = 0;
+    blcl::net::connection_stats stats;
+};
+
+result run(uint16_t port, blcl::net::priority ping_lane, int pings) {
+    constexpr size_t BACKLOG = 8000;
+    message bulk;
+    bulk.header.id = MsgType::Bulk;
+    bulk.body.resize(480);
+    bulk.header.size = bulk.size();
+
+    bulk_server server(port, ping_lane);
+    server.start();
+    std::atomic<bool> running = true;
+    std::thread update_thread([&]() {
+        while (running) {
+            server.update(64, false);
+            server.feed(BACKLOG, bulk);
+            std::this_thread::yield();
+        }
+    });
+
+    blcl::net::client_interface<MsgType> client;
+    client.connect("127.0.0.1", port);
+    while (!client.is_connected())
+        std::this_thread::yield();
+
+    result r;
+    auto deadline = clock_type::now() + std::chrono::seconds(30);
+    for (int i = 0; i < pings && clock_type::now() < deadline; i++) {
+        message ping;
+        ping.header.id = MsgType::ServerPing;
+        auto sent = clock_type::now();
+        ping << sent.time_since_epoch().count();
+        client.send(ping);
+
+        // Everything queued is taken each pass, so the client's own queue never holds the pong back.
+        bool answered = false;
+        while (!answered && clock_type::now() < deadline) {
+            size_t taken = client.get_incoming_messages().drain([&](blcl::net::owned_message<MsgType> in) {
+                if (in.msg.header.id != MsgType::ServerPing) {
+                    r.bulk_received++;
+                    return;
+                }
+                r.rtt_us.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - sent).count());
+                answered = true;
+            });
+            if (taken == 0)
+                std::this_thread::yield();
+        }
+    }
+
+    r.stats = server.client_stats();
+    client.disconnect();
+    running = false;
+    update_thread.join();
+    server.stop();
+    return r;
+}
+
+double percentile(std::vector<double>& v, double p) {
+    if (v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, size_t(p * v.size()))];
+}
+
+int main() {
+    constexpr int PINGS = 500;
+    bool ok = true;
+    std::vector<double> p50;
+    uint16_t port = 60150;
+    for (auto [lane, name]: { std::pair { blcl::net::priority::bulk, "bulk" },
+                              std::pair { blcl::net::priority::high, "high" } }) {
+        auto r = run(port++, lane, PINGS);
+        ok &= r.rtt_us.size() == PINGS;
+        p50.push_back(percentile(r.rtt_us, 0.5));
+        std::cout << "pong on " << name << " lane: " << r.rtt_us.size() << " pings"
+                  << " p50=" << percentile(r.rtt_us, 0.5) << " us"
+                  << " p99=" << percentile(r.rtt_us, 0.99) << " us"
+                  << " bulk received=" << r.bulk_received << "\n";
+        for (auto [i, lane_name]: { std::pair { 0, "high" }, std::pair { 1, "normal" }, std::pair { 2, "bulk" } })
+            std::cout << "  lane " << lane_name << ": messages_out=" << r.stats.lanes[i].messages_out
+                      << " bytes_out=" << r.stats.lanes[i].bytes_out << "\n";
+    }
+    // The high lane has to answer faster than the bulk lane, or it isn't doing its job.
+    if (p50[1] >= p50[0]) {
+        std::cout << "high lane p50 is no better than bulk lane p50\n";
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+#include <iostream>
+#include <chrono>
+#include <blcl_net.h>
+
+// Producer threads push owned messages the way connections do; one consumer drains them like server_interface::update().
+enum class MsgType: uint32_t {
+    MessageAll
+};
+
+using item_t = blcl::net::owned_message<MsgType>;
+constexpr size_t MESSAGES_TOTAL = 2'000'000;
+
+template <typename Queue, typename Consume>
+double run(Queue& queue, size_t producers, Consume consume) {
+    size_t per_producer = MESSAGES_TOTAL / producers;
+    size_t expected = per_producer * producers;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, per_producer]() {
+            for (size_t i = 0; i < per_producer; i++) {
+                item_t item;
+                item.msg.header.id = MsgType::MessageAll;
+                queue.push_back(std::move(item));
+            }
+        });
+    }
+
+    size_t received = 0;
+    while (received < expected) {
+        queue.wait();
+        received += consume(queue);
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto& t: threads)
+        t.join();
+    return expected / elapsed;
+}
+
+int main() {
+    for (size_t producers: { 1, 4, 16 }) {
+        blcl::net::tsqueue<item_t> ts;
+        double ts_rate = run(ts, producers, [](blcl::net::tsqueue<item_t>& q) {
+            size_t n = 0;
+            while (!q.empty()) {
+                q.pop_front();
+                n++;
+            }
+            return n;
+        });
+
+        blcl::net::mpsc_queue<item_t> mpsc;
+        double mpsc_rate = run(mpsc, producers, [](blcl::net::mpsc_queue<item_t>& q) {
+            return q.drain([](item_t) { });
+        });
+
+        std::cout << "producers=" << producers
+                  << " tsqueue=" << ts_rate / 1e6 << " Mmsg/s"
+                  << " mpsc_queue=" << mpsc_rate / 1e6 << " Mmsg/s\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <iostream>
+#include <chrono>
+#include <blcl_net.h>
+
+// Streams small 20-60 byte frames over loopback and compares the old reader (one async_read for the header and one
+// for the body of every frame) with connection<T>'s buffered reader.
+enum class MsgType: uint32_t {
+    MessageAll
+};
+
+using queue_t = blcl::net::mpsc_queue<blcl::net::owned_message<MsgType>>;
+
+constexpr size_t FRAMES_PER_BLOCK = 1000;
+constexpr size_t BLOCKS = 1000;
+constexpr size_t FRAMES_TOTAL = FRAMES_PER_BLOCK * BLOCKS;
+
+std::vector<uint8_t> make_block() {
+    std::vector<uint8_t> block;
+    for (size_t i = 0; i < FRAMES_PER_BLOCK; i++) {
+        blcl::net::message_header<MsgType> header { MsgType::MessageAll, uint32_t(12 + i % 41) };
+        auto* p = reinterpret_cast<const uint8_t*>(&header);
+        block.insert(block.end(), p, p + sizeof(header));
+        block.resize(block.size() + header.size, uint8_t(i));
+    }
+    return block;
+}
+
+// Plays the server side of the handshake, then streams the frames.
+void serve(asio::ip::tcp::acceptor& acceptor, const std::vector<uint8_t>& block) {
+    asio::io_context context;
+    asio::ip::tcp::socket socket(context);
+    acceptor.accept(socket);
+
+    uint64_t checksum = 0;
+    asio::write(socket, asio::buffer(&checksum, sizeof(checksum)));
+    blcl::net::client_hello hello;
+    asio::read(socket, asio::buffer(&hello, sizeof(hello)));
+    blcl::net::session_info session { 1, 0, 1 };
+    asio::write(socket, asio::buffer(&session, sizeof(session)));
+    for (size_t i = 0; i < BLOCKS; i++)
+        asio::write(socket, asio::buffer(block));
+}
+
+// The reader as it was: a header read, then a body read, per frame.
+class legacy_reader {
+public:
+    legacy_reader(asio::ip::tcp::socket& socket, queue_t& queue): socket_(socket), queue_(queue) {
+
+    }
+
+    void read_header() {
+        asio::async_read(socket_, asio::buffer(&msg_.header, sizeof(msg_.header)),
+            [this](std::error_code ec, std::size_t length) {
+                if (ec)
+                    return;
+                if (msg_.header.size > 0) {
+                    msg_.body.resize(msg_.header.size);
+                    read_body();
+                } else {
+                    push();
+                }
+        });
+    }
+
+private:
+    void read_body() {
+        asio::async_read(socket_, asio::buffer(msg_.body.data(), msg_.body.size()),
+            [this](std::error_code ec, std::size_t length) {
+                if (!ec)
+                    push();
+        });
+    }
+
+    void push() {
+        queue_.push_back({ nullptr, msg_ });
+        read_header();
+    }
+
+    asio::ip::tcp::socket& socket_;
+    queue_t& queue_;
+    blcl::net::message<MsgType> msg_;
+};
+
+template <typename StartReader>
+double run(const std::vector<uint8_t>& block, StartReader start_reader) {
+    asio::io_context context;
+    asio::ip::tcp::acceptor acceptor(context, asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    queue_t queue;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread server([&]() { serve(acceptor, block); });
+    auto reader = start_reader(context, acceptor.local_endpoint(), queue);
+    std::thread io_thread([&]() { context.run(); });
+
+    size_t received = 0;
+    while (received < FRAMES_TOTAL) {
+        queue.wait();
+        received += queue.drain([](blcl::net::owned_message<MsgType>) { });
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    server.join();
+    context.stop();
+    io_thread.join();
+    return FRAMES_TOTAL / elapsed;
+}
+
+int main() {
+    auto block = make_block();
+
+    double legacy = run(block, [](asio::io_context& context, asio::ip::tcp::endpoint endpoint, queue_t& queue) {
+        auto socket = std::make_shared<asio::ip::tcp::socket>(context);
+        socket->connect(endpoint);
+        blcl::net::client_hello hello;
+        asio::read(*socket, asio::buffer(&hello.checksum, sizeof(hello.checksum)));
+        asio::write(*socket, asio::buffer(&hello, sizeof(hello)));
+        blcl::net::session_info session;
+        asio::read(*socket, asio::buffer(&session, sizeof(session)));
+        auto reader = std::make_shared<legacy_reader>(*socket, queue);
+        reader->read_header();
+        return std::make_pair(socket, reader);
+    });
+
+    double buffered = run(block, [](asio::io_context& context, asio::ip::tcp::endpoint endpoint, queue_t& queue) {
+        asio::ip::tcp::resolver resolver(context);
+        auto conn = std::make_shared<blcl::net::connection<MsgType>>(
+                blcl::net::connection<MsgType>::owner::client, context, asio::ip::tcp::socket(context), queue);
+        conn->connect_to_server(resolver.resolve(endpoint));
+        return conn;
+    });
+
+    std::cout << "frames=" << FRAMES_TOTAL
+              << " legacy=" << legacy / 1e6 << " Mmsg/s"
+              << " buffered=" << buffered / 1e6 << " Mmsg/s\n";
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <chrono>
+#include <blcl_net.h>
+
+// Runs the unreliable channel over loopback with simulated datagram loss in both directions.
+// The client streams numbered state updates that the server echoes back unreliably; both sides
+// check that latest-wins delivery never hands up an update older than one already seen.
+enum class MsgType: uint32_t {
+    ServerAccept,
+    State
+};
+
+constexpr uint32_t UPDATES = 2000;
+constexpr double LOSS_RATE = 0.2;
+
+class LossServer: public blcl::net::server_interface<MsgType> {
+public:
+    LossServer(): blcl::net::server_interface<MsgType>(0, 1) {
+
+    }
+
+    ~LossServer() override {
+        stop();
+    }
+
+    uint16_t port() const {
+        return asio_acceptor_.local_endpoint().port();
+    }
+
+    uint32_t received = 0;
+    uint32_t stale = 0;
+
+protected:
+    bool on_client_connect(std::shared_ptr<blcl::net::connection<MsgType>> client) override {
+        return true;
+    }
+
+    void on_message(std::shared_ptr<blcl::net::connection<MsgType>> client, blcl::net::message<MsgType>& msg) override {
+        uint32_t counter = 0;
+        msg >> counter;
+        if (counter <= last_)
+            stale++;
+        last_ = counter;
+        received++;
+
+        msg << counter;
+        client->send_unreliable(msg);
+    }
+
+private:
+    uint32_t last_ = 0;
+};
+
+int main() {
+    LossServer server;
+    server.enable_unreliable_channel();
+    server.get_unreliable_channel()->set_simulated_loss(LOSS_RATE);
+    server.start();
+
+    std::atomic<bool> quit = false;
+    std::thread server_thread([&]() {
+        while (!quit)
+            server.update(-1, false);
+    });
+
+    blcl::net::client_interface<MsgType> client;
+    client.connect("127.0.0.1", server.port(), true);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!client.is_unreliable_channel_bound() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (!client.is_unreliable_channel_bound()) {
+        std::cout << "[ERR] UDP channel never bound.\n";
+        return 1;
+    }
+
+    uint32_t echoed = 0, client_stale = 0, last = 0;
+    auto drain = [&]() {
+        client.get_incoming_messages().drain([&](blcl::net::owned_message<MsgType> owned) {
+            uint32_t counter = 0;
+            owned.msg >> counter;
+            if (counter <= last)
+                client_stale++;
+            last = counter;
+            echoed++;
+        });
+    };
+
+    for (uint32_t i = 1; i <= UPDATES; i++) {
+        blcl::net::message<MsgType> msg;
+        msg.header.id = MsgType::State;
+        msg << i;
+        client.send_unreliable(msg);
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        drain();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    drain();
+
+    quit = true;
+    server_thread.join();
+
+    std::cout << "loss=" << LOSS_RATE
+              << " sent=" << UPDATES
+              << " server_received=" << server.received << " server_stale=" << server.stale
+              << " client_received=" << echoed << " client_stale=" << client_stale << "\n";
+
+    return server.stale == 0 && client_stale == 0 ? 0 : 1;
+}
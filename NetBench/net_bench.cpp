@@ -0,0 +1,384 @@
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <future>
+#include <map>
+#include <string>
+#include <blcl_net.h>
+
+// Load generator: N simulated clients on a small thread pool, all going through client_interface<T>, against an
+// in-process server_interface (default) or a server reached over the network (--connect host:port).
+//
+//   net_bench --workload ping|broadcast|state --clients 200 --rate 20 --duration 10
+//
+// --server-mode picks how the in-process server handles messages:
+// queued:    on_message on the update thread, behind the shared incoming queue (default).
+// inline:    on_message on the I/O thread that read the message (enable_inline_dispatch); ping and broadcast only.
+// coroutine: one coroutine per client awaiting connection::receive() on the client's strand; ping and broadcast only.
+// --sharded 1 gives the in-process server one shard per I/O thread, each with its own acceptor and registry.
+// --resume 1 has it keep every client's unacknowledged messages for session resumption; clients acknowledge them.
+//
+// ping:      each client sends ServerPing at --rate Hz; the server echoes it. Reports RTT.
+// broadcast: each client sends MessageAll at --rate Hz; the server relays it to every other client.
+// state:     each client sends MessageAll at --rate Hz; the server batches them into one snapshot per tick
+//            (--tick Hz), as SimpleServer does.
+// For broadcast and state, latency is from the sender's send() to the recipient's socket read.
+// The message ids match SimpleServer, so ping and state also work against it with --connect; note that
+// SimpleServer treats MessageAll as a state update, so broadcast behaves like state there.
+//
+// Reported: latency p50/p99/p999, messages sent and received per second, and (in-process only) the CPU time of
+// the server's I/O threads and update thread as a percentage of one core.
+
+enum class MsgType: uint32_t {
+    ServerAccept,
+    ServerDeny,
+    ServerPing,
+    MessageAll,
+    ServerMessage,
+    ServerSnapshot
+};
+
+using client_type = blcl::net::client_interface<MsgType>;
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+    std::string workload = "ping";
+    std::string server_mode = "queued";
+    bool sharded = false;
+    bool resume = false;
+    size_t clients = 100;
+    size_t client_threads = 2;
+    size_t server_threads = 2;
+    double rate = 20;
+    double tick = 30;
+    double duration = 5;
+    size_t payload = 32;
+    std::string host;
+    uint16_t port = 0;
+};
+
+// First bytes of every body the bench sends; the rest is padding up to --payload.
+struct probe {
+    uint64_t sent_ns;
+    uint32_t sender;
+    static constexpr auto schema = blcl::net::schema_fields(&probe::sent_ns, &probe::sender);
+};
+
+uint64_t now_ns() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count());
+}
+
+double thread_cpu_seconds() {
+    timespec ts {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+}
+
+class bench_server: public blcl::net::server_interface<MsgType> {
+public:
+    bench_server(uint16_t port, size_t threads, bool sharded, bool relay): server_interface(port, threads, sharded), relay_(relay) {
+
+    }
+
+    ~bench_server() override {
+        stop();
+    }
+
+    // Serves every client from a coroutine instead of on_message. Call before start().
+    void use_coroutines() {
+        enable_direct_receive();
+        asio::co_spawn(*io_contexts_.front(), accept_clients(), asio::detached);
+    }
+
+    uint16_t port() const {
+        return asio_acceptor_.local_endpoint().port();
+    }
+
+    // Wakes update() so the update thread can notice it should exit.
+    void wake() {
+        shards_.front()->incoming_messages.push_back({ nullptr, {}, std::chrono::steady_clock::now() });
+    }
+
+    // CPU seconds used so far by each I/O thread, read on the thread itself.
+    double io_cpu_seconds() {
+        double total = 0;
+        for (auto& context: io_contexts_) {
+            std::promise<double> cpu;
+            asio::post(*context, [&cpu]() { cpu.set_value(thread_cpu_seconds()); });
+            total += cpu.get_future().get();
+        }
+        return total;
+    }
+
+protected:
+    bool on_client_connect(std::shared_ptr<blcl::net::connection<MsgType>> client) override {
+        blcl::net::message<MsgType> msg;
+        msg.header.id = MsgType::ServerAccept;
+        client->send(std::move(msg));
+        return true;
+    }
+
+    void on_message(std::shared_ptr<blcl::net::connection<MsgType>> client, blcl::net::message<MsgType>& msg) override {
+        if (!client)
+            return;
+        switch (msg.header.id) {
+            case MsgType::ServerPing:
+                client->send(std::move(msg));
+                break;
+            case MsgType::MessageAll:
+                msg.header.id = MsgType::ServerMessage;
+                if (relay_)
+                    broadcast_message(std::move(msg), client);
+                else
+                    queue_state_update(client, std::move(msg));
+                break;
+            default:
+                break;
+        }
+    }
+
+private:
+    asio::awaitable<void> accept_clients() {
+        while (true) {
+            auto client = co_await accept();
+            asio::co_spawn(client->get_executor(), serve(client), asio::detached);
+        }
+    }
+
+    asio::awaitable<void> serve(std::shared_ptr<blcl::net::connection<MsgType>> client) {
+        try {
+            while (true) {
+                blcl::net::message<MsgType> msg = co_await client->receive();
+                on_message(client, msg);
+            }
+        } catch (const std::exception&) {
+            // The connection closed.
+        }
+    }
+
+    bool relay_;
+};
+
+// One driver thread: paces its share of the clients and consumes what they receive.
+struct driver {
+    std::vector<client_type*> clients;
+    blcl::net::latency_histogram latency;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+};
+
+void drive(driver& d, const options& opt, uint32_t first_index, clock_type::time_point start, clock_type::time_point end) {
+    MsgType send_id = opt.workload == "ping" ? MsgType::ServerPing : MsgType::MessageAll;
+    auto period = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(1.0 / opt.rate));
+    // Spread the clients' first sends over one period so they don't all fire together.
+    std::vector<clock_type::time_point> next(d.clients.size());
+    for (size_t i = 0; i < next.size(); i++)
+        next[i] = start + period * i / next.size();
+
+    auto record = [&](const blcl::net::owned_message<MsgType>& in, const blcl::net::message<MsgType>& msg) {
+        probe p {};
+        if (!msg.reader().read(p))
+            return;
+        auto received_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(in.received.time_since_epoch()).count());
+        d.latency.record(received_ns > p.sent_ns ? received_ns - p.sent_ns : 0);
+        d.received++;
+    };
+
+    while (clock_type::now() < end) {
+        auto now = clock_type::now();
+        auto earliest = end;
+        for (size_t i = 0; i < d.clients.size(); i++) {
+            if (next[i] <= now) {
+                blcl::net::message<MsgType> msg;
+                msg.header.id = send_id;
+                msg.write(probe { now_ns(), first_index + uint32_t(i) });
+                if (opt.payload > blcl::net::encoded_size<probe>())
+                    msg.body.resize(opt.payload);
+                msg.header.size = msg.size();
+                d.clients[i]->send(std::move(msg));
+                d.sent++;
+                next[i] += period;
+            }
+            earliest = std::min(earliest, next[i]);
+
+            d.clients[i]->get_incoming_messages().drain([&](blcl::net::owned_message<MsgType> in) {
+                switch (in.msg.header.id) {
+                    case MsgType::ServerPing:
+                    case MsgType::ServerMessage:
+                        record(in, in.msg);
+                        break;
+                    case MsgType::ServerSnapshot:
+                        blcl::net::snapshot_batcher<MsgType>::read(in.msg, [&](uint32_t, blcl::net::message<MsgType>& entry) {
+                            record(in, entry);
+                        });
+                        break;
+                    default:
+                        break;
+                }
+            });
+        }
+        // Latency is taken from the socket read timestamps, so polling late only delays the bookkeeping.
+        std::this_thread::sleep_until(std::min(earliest, clock_type::now() + std::chrono::microseconds(200)));
+    }
+}
+
+bool parse(int argc, char** argv, options& opt) {
+    std::map<std::string, std::string> args;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strncmp(argv[i], "--", 2) != 0)
+            return false;
+        args[argv[i] + 2] = argv[i + 1];
+    }
+    if (argc % 2 == 0)
+        return false;
+
+    for (const auto& [key, value]: args) {
+        if (key == "workload") opt.workload = value;
+        else if (key == "server-mode") opt.server_mode = value;
+        else if (key == "sharded") opt.sharded = value == "1";
+        else if (key == "resume") opt.resume = value == "1";
+        else if (key == "clients") opt.clients = std::stoul(value);
+        else if (key == "client-threads") opt.client_threads = std::max<size_t>(1, std::stoul(value));
+        else if (key == "server-threads") opt.server_threads = std::max<size_t>(1, std::stoul(value));
+        else if (key == "rate") opt.rate = std::stod(value);
+        else if (key == "tick") opt.tick = std::stod(value);
+        else if (key == "duration") opt.duration = std::stod(value);
+        else if (key == "payload") opt.payload = std::stoul(value);
+        else if (key == "connect") {
+            auto colon = value.rfind(':');
+            if (colon == std::string::npos)
+                return false;
+            opt.host = value.substr(0, colon);
+            opt.port = uint16_t(std::stoul(value.substr(colon + 1)));
+        } else {
+            return false;
+        }
+    }
+    if (opt.server_mode != "queued" && ((opt.server_mode != "inline" && opt.server_mode != "coroutine") || opt.workload == "state"))
+        return false;
+    return opt.workload == "ping" || opt.workload == "broadcast" || opt.workload == "state";
+}
+
+int main(int argc, char** argv) {
+    options opt;
+    if (!parse(argc, argv, opt)) {
+        std::cerr << "usage: net_bench [--workload ping|broadcast|state] [--clients N] [--rate Hz] [--duration s]\n"
+                     "                 [--payload bytes] [--tick Hz] [--client-threads N] [--server-threads N]\n"
+                     "                 [--server-mode queued|inline|coroutine] [--sharded 0|1] [--resume 0|1]\n"
+                     "                 [--connect host:port]\n";
+        return 2;
+    }
+
+    std::unique_ptr<bench_server> server;
+    std::thread update_thread;
+    std::atomic<bool> running = true;
+    std::promise<double> update_cpu;
+    std::string host = opt.host;
+    uint16_t port = opt.port;
+    if (host.empty()) {
+        server = std::make_unique<bench_server>(0, opt.server_threads, opt.sharded, opt.workload == "broadcast");
+        if (opt.resume)
+            server->enable_session_resumption(std::chrono::seconds(30));
+        if (opt.server_mode == "inline")
+            server->enable_inline_dispatch();
+        else if (opt.server_mode == "coroutine")
+            server->use_coroutines();
+        server->start();
+        host = "127.0.0.1";
+        port = server->port();
+        update_thread = std::thread([&]() {
+            if (opt.workload == "state") {
+                server->run_ticks(opt.tick, MsgType::ServerSnapshot);
+            } else {
+                while (running)
+                    server->update(-1, true);
+            }
+            update_cpu.set_value(thread_cpu_seconds());
+        });
+    }
+
+    // Clients share a pool of io_contexts, one thread each.
+    std::vector<std::unique_ptr<asio::io_context>> contexts;
+    std::vector<asio::executor_work_guard<asio::io_context::executor_type>> guards;
+    std::vector<std::thread> io_threads;
+    for (size_t i = 0; i < opt.client_threads; i++) {
+        contexts.emplace_back(std::make_unique<asio::io_context>(1));
+        guards.emplace_back(asio::make_work_guard(*contexts.back()));
+    }
+    for (auto& context: contexts)
+        io_threads.emplace_back([&context]() { context->run(); });
+
+    std::vector<std::unique_ptr<client_type>> clients;
+    auto connect_start = clock_type::now();
+    for (size_t i = 0; i < opt.clients; i++) {
+        clients.emplace_back(std::make_unique<client_type>(*contexts[i % contexts.size()], 1024));
+        clients.back()->connect(host, port);
+    }
+    auto connect_deadline = clock_type::now() + std::chrono::seconds(10);
+    for (auto& client: clients)
+        while (!client->is_connected() && clock_type::now() < connect_deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double connect_ms = std::chrono::duration<double, std::milli>(clock_type::now() - connect_start).count();
+    // Let the handshakes finish before the clock starts.
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    std::vector<driver> drivers(opt.client_threads);
+    for (size_t i = 0; i < clients.size(); i++)
+        drivers[i * drivers.size() / clients.size()].clients.push_back(clients[i].get());
+
+    double server_cpu_start = server ? server->io_cpu_seconds() : 0;
+    auto start = clock_type::now();
+    auto end = start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(opt.duration));
+    std::vector<std::thread> driver_threads;
+    uint32_t first_index = 0;
+    for (auto& d: drivers) {
+        driver_threads.emplace_back(drive, std::ref(d), std::cref(opt), first_index, start, end);
+        first_index += uint32_t(d.clients.size());
+    }
+    for (auto& thread: driver_threads)
+        thread.join();
+    double elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+
+    double server_cpu = 0;
+    if (server) {
+        server_cpu = server->io_cpu_seconds() - server_cpu_start;
+        running = false;
+        server->stop_ticks();
+        server->wake();
+        update_thread.join();
+        // The update thread's clock includes the warm-up; close enough next to the I/O threads for a regression check.
+        server_cpu += update_cpu.get_future().get();
+    }
+
+    blcl::net::histogram_snapshot latency;
+    uint64_t sent = 0, received = 0;
+    for (auto& d: drivers) {
+        latency.merge(d.latency.snapshot());
+        sent += d.sent;
+        received += d.received;
+    }
+
+    std::cout << "workload=" << opt.workload << " clients=" << opt.clients << " rate=" << opt.rate << "Hz"
+              << " payload=" << opt.payload << "B"
+              << (server ? " server=in-process mode=" + opt.server_mode + (opt.sharded ? " sharded" : "") + (opt.resume ? " resume" : "") : " server=" + opt.host) << "\n"
+              << "connect=" << connect_ms << "ms\n"
+              << "sent=" << uint64_t(sent / elapsed) << " msg/s received=" << uint64_t(received / elapsed) << " msg/s\n"
+              << (opt.workload == "ping" ? "rtt" : "latency")
+              << " p50=" << latency.percentile(0.5) / 1000.0 << "us"
+              << " p99=" << latency.percentile(0.99) / 1000.0 << "us"
+              << " p999=" << latency.percentile(0.999) / 1000.0 << "us"
+              << " max=" << latency.max / 1000.0 << "us\n";
+    if (server)
+        std::cout << "server_cpu=" << 100.0 * server_cpu / elapsed << "% of one core\n";
+
+    guards.clear();
+    for (auto& context: contexts)
+        context->stop();
+    for (auto& thread: io_threads)
+        thread.join();
+    clients.clear();
+    if (server)
+        server->stop();
+    return received > 0 ? 0 : 1;
+}
@@ -3,15 +3,18 @@
 
 struct Vector {
     float x; float y; float z;
+    static constexpr auto schema = blcl::net::schema_fields(&Vector::x, &Vector::y, &Vector::z);
 };
 struct Quad {
     float x; float y; float z; float w;
+    static constexpr auto schema = blcl::net::schema_fields(&Quad::x, &Quad::y, &Quad::z, &Quad::w);
 };
 
 struct State {
     uint32_t type;
     Vector pos;
     Quad rot;
+    static constexpr auto schema = blcl::net::schema_fields(&State::type, &State::pos, &State::rot);
 };
 
 enum class MsgType: uint32_t {
@@ -19,7 +22,8 @@ enum class MsgType: uint32_t {
     ServerDeny,
     ServerPing,
     MessageAll,
-    ServerMessage
+    ServerMessage,
+    ServerSnapshot
 };
 
 class CustomClient: public blcl::net::client_interface<MsgType> {
@@ -31,7 +35,7 @@ public:
         std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
         std::cout << sizeof(now) << "\n";
         msg << now;
-        send(msg);
+        send(std::move(msg));
     }
 
     void broadcast_message() {
@@ -41,8 +45,8 @@ public:
         state.type = 0;
         state.pos = {40, 15, -153};
         state.rot = {0, 0, 0, 0 };
-        msg << state;
-        send(msg);
+        msg.write(state);
+        send(std::move(msg));
     }
 };
 
@@ -71,21 +75,26 @@ int main() {
                                       << " ms\n";
                             break;
                         }
-                        case MsgType::ServerMessage: {
-                            uint32_t client_id;
-                            msg >> client_id;
-                            std::cout << "Client ID: " << client_id << " Size: " << msg.size() << std::endl;
+                        case MsgType::ServerSnapshot: {
+                            blcl::net::snapshot_batcher<MsgType>::read(msg, [](uint32_t client_id, blcl::net::message<MsgType>& update) {
+                                std::cout << "Client ID: " << client_id << " Size: " << update.size() << std::endl;
 
-                            Vector pos;
-                            Quad rot;
-                            int ball = 0;
-                            msg >> rot >> pos >> ball;
-                            std::cout << "[INFO] Client " << client_id << ": " <<
-                            "Ball: " << ball << " "
-                            "(" << pos.x << ", " << pos.y << ", " << pos.z << "), " <<
-                            "(" << rot.x << ", " << rot.y << ", " << rot.z << ", " << rot.w << ")" << "\n";
+                                State state;
+                                if (!update.reader().read(state)) {
+                                    std::cout << "[WARN] Client " << client_id << ": Malformed state.\n";
+                                    return;
+                                }
+                                const Vector& pos = state.pos;
+                                const Quad& rot = state.rot;
+                                std::cout << "[INFO] Client " << client_id << ": " <<
+                                "Type: " << state.type << " "
+                                "(" << pos.x << ", " << pos.y << ", " << pos.z << "), " <<
+                                "(" << rot.x << ", " << rot.y << ", " << rot.z << ", " << rot.w << ")" << "\n";
+                            });
                             break;
                         }
+                        default:
+                            break;
                     }
                 }
             } else {
@@ -5,8 +5,23 @@
 #ifndef NETCLIENT_BLCL_NET_H
 #define NETCLIENT_BLCL_NET_H
 #include "net_common.h"
+#include "net_buffer_pool.h"
+#include "net_schema.h"
 #include "net_message.h"
+#include "net_handshake.h"
+#include "net_udp.h"
+#include "net_spatial.h"
+#include "net_snapshot.h"
+#include "net_delta.h"
+#include "net_compression.h"
+#include "net_stats.h"
+#include "net_slot_map.h"
+#include "net_timer_wheel.h"
+#include "net_completion.h"
+#include "net_admission.h"
 #include "net_tsqueue.h"
+#include "net_mpsc_queue.h"
+#include "net_log.h"
 #include "net_client.h"
 #include "net_server.h"
 #include "net_connection.h"
@@ -0,0 +1,116 @@
+#ifndef NETCLIENT_NET_ADMISSION_H
+#define NETCLIENT_NET_ADMISSION_H
+
+#include "net_common.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+namespace blcl::net {
+    // Counts connection attempts per remote address in a count-min sketch: DEPTH rows of WIDTH counters, where an
+    // address bumps one counter in each row and reads as the smallest of them. Collisions only ever overcount, so an
+    // address is never let in past its limit, though one unlucky enough to share every counter with a busy address
+    // can be turned away early. All counters halve every half_life, so an address that stops hammering the server
+    // is let back in. Keyed on the address bytes, with IPv4-mapped IPv6 counted as IPv4, and hashed with a per-process
+    // salt so colliding addresses can't be picked in advance. Lock-free: any thread may call admit() and penalize().
+    class admission_controller {
+    public:
+        static constexpr size_t DEPTH = 4;
+        static constexpr size_t WIDTH = 4096;
+
+        admission_controller(uint32_t max_attempts, std::chrono::steady_clock::duration half_life)
+            : max_attempts_(max_attempts), half_life_(std::max<int64_t>(1, half_life.count())),
+            next_decay_(std::chrono::steady_clock::now().time_since_epoch().count() + half_life_),
+            salt_(std::random_device{}() | uint64_t(std::random_device{}()) << 32)
+        {
+
+        }
+
+        // Counts an attempt from address; false if that takes it past max_attempts.
+        bool admit(const asio::ip::address& address) {
+            return bump(address, 1) <= max_attempts_;
+        }
+
+        // Counts weight extra attempts against address, e.g. for a failed handshake.
+        void penalize(const asio::ip::address& address, uint32_t weight) {
+            bump(address, weight);
+        }
+
+        uint32_t estimate(const asio::ip::address& address) const {
+            uint64_t h1, h2;
+            hash(address, h1, h2);
+            uint32_t count = UINT32_MAX;
+            for (size_t row = 0; row < DEPTH; row++)
+                count = std::min(count, counters_[row][(h1 + row * h2) & (WIDTH - 1)].load(std::memory_order_relaxed));
+            return count;
+        }
+
+    private:
+        uint32_t bump(const asio::ip::address& address, uint32_t weight) {
+            decay();
+            uint64_t h1, h2;
+            hash(address, h1, h2);
+            uint32_t count = UINT32_MAX;
+            for (size_t row = 0; row < DEPTH; row++) {
+                uint32_t c = counters_[row][(h1 + row * h2) & (WIDTH - 1)].fetch_add(weight, std::memory_order_relaxed);
+                count = std::min(count, c + weight);
+            }
+            return count;
+        }
+
+        // Whoever first sees a half-life go by halves the counters, once per half-life that went by. Attempts
+        // counted while that runs may be halved or not; for a rate limit either is close enough.
+        void decay() {
+            int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+            int64_t due = next_decay_.load(std::memory_order_relaxed);
+            if (now < due)
+                return;
+            int64_t periods = (now - due) / half_life_ + 1;
+            if (!next_decay_.compare_exchange_strong(due, due + periods * half_life_, std::memory_order_relaxed))
+                return;
+            int shift = int(std::min<int64_t>(periods, 32));
+            for (auto& row: counters_) {
+                for (auto& counter: row) {
+                    uint32_t c = counter.load(std::memory_order_relaxed);
+                    if (c != 0)
+                        counter.store(shift >= 32 ? 0 : c >> shift, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Two independent hashes of the address; row i uses h1 + i * h2.
+        void hash(const asio::ip::address& address, uint64_t& h1, uint64_t& h2) const {
+            uint64_t hi = 0, lo = 0;
+            if (address.is_v6() && !address.to_v6().is_v4_mapped()) {
+                auto bytes = address.to_v6().to_bytes();
+                std::memcpy(&hi, bytes.data(), 8);
+                std::memcpy(&lo, bytes.data() + 8, 8);
+                hi ^= 1;
+            } else {
+                lo = address.is_v4() ? address.to_v4().to_uint()
+                                     : asio::ip::make_address_v4(asio::ip::v4_mapped, address.to_v6()).to_uint();
+            }
+            h1 = mix(lo ^ mix(hi ^ salt_));
+            h2 = mix(h1 ^ salt_) | 1;
+        }
+
+        // splitmix64's finalizer.
+        static uint64_t mix(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xBF58476D1CE4E5B9ull;
+            x ^= x >> 27;
+            x *= 0x94D049BB133111EBull;
+            return x ^ x >> 31;
+        }
+
+        uint32_t max_attempts_;
+        int64_t half_life_;
+        std::atomic<int64_t> next_decay_;
+        uint64_t salt_;
+        std::array<std::array<std::atomic<uint32_t>, WIDTH>, DEPTH> counters_ {};
+    };
+}
+
+#endif //NETCLIENT_NET_ADMISSION_H
@@ -0,0 +1,165 @@
+#ifndef NETCLIENT_NET_BUFFER_POOL_H
+#define NETCLIENT_NET_BUFFER_POOL_H
+#include "net_common.h"
+#include <array>
+#include <vector>
+
+namespace blcl::net {
+    // Size-classed block pool for message bodies.
+    // Each thread keeps a small cache per class and trades blocks in batches with a shared depot, so buffers
+    // allocated on an I/O thread and released on the update() thread still get recycled.
+    class buffer_pool {
+    public:
+        static constexpr size_t MIN_CLASS_SHIFT = 6;   // 64 bytes
+        static constexpr size_t CLASS_COUNT = 11;      // up to 64 KiB
+        static constexpr size_t MAX_CLASS_SIZE = size_t(1) << (MIN_CLASS_SHIFT + CLASS_COUNT - 1);
+        static constexpr size_t CACHE_LIMIT = 256;     // blocks per class kept by each thread
+        static constexpr size_t BATCH_SIZE = CACHE_LIMIT / 2;
+
+        // Rounds n up to the block size it would be served from. Sizes beyond the largest class are unpooled.
+        static size_t class_size(size_t n) {
+            if (n > MAX_CLASS_SIZE)
+                return n;
+            return size_t(1) << (MIN_CLASS_SHIFT + class_index(n));
+        }
+
+        static void* allocate(size_t n) {
+            if (n > MAX_CLASS_SIZE)
+                return ::operator new(n);
+
+            size_t index = class_index(n);
+            auto& blocks = local_cache().blocks[index];
+            if (blocks.empty())
+                get_depot().refill(index, blocks);
+            if (blocks.empty())
+                return ::operator new(size_t(1) << (MIN_CLASS_SHIFT + index));
+
+            void* p = blocks.back();
+            blocks.pop_back();
+            return p;
+        }
+
+        static void deallocate(void* p, size_t n) {
+            if (n > MAX_CLASS_SIZE) {
+                ::operator delete(p);
+                return;
+            }
+
+            size_t index = class_index(n);
+            auto& blocks = local_cache().blocks[index];
+            if (blocks.size() >= CACHE_LIMIT)
+                get_depot().release(index, blocks, BATCH_SIZE);
+            blocks.push_back(p);
+        }
+
+    private:
+        static size_t class_index(size_t n) {
+            size_t index = 0;
+            while ((size_t(1) << (MIN_CLASS_SHIFT + index)) < n)
+                index++;
+            return index;
+        }
+
+        struct depot {
+            std::mutex mtx;
+            std::array<std::vector<void*>, CLASS_COUNT> blocks;
+
+            ~depot() {
+                for (auto& list: blocks)
+                    for (void* p: list)
+                        ::operator delete(p);
+            }
+
+            void refill(size_t index, std::vector<void*>& out) {
+                std::scoped_lock lock(mtx);
+                auto& list = blocks[index];
+                size_t n = std::min(BATCH_SIZE, list.size());
+                out.insert(out.end(), list.end() - n, list.end());
+                list.resize(list.size() - n);
+            }
+
+            void release(size_t index, std::vector<void*>& in, size_t n) {
+                std::scoped_lock lock(mtx);
+                n = std::min(n, in.size());
+                blocks[index].insert(blocks[index].end(), in.end() - n, in.end());
+                in.resize(in.size() - n);
+            }
+        };
+
+        struct thread_cache {
+            std::array<std::vector<void*>, CLASS_COUNT> blocks;
+
+            thread_cache() {
+                get_depot();
+                for (auto& list: blocks)
+                    list.reserve(CACHE_LIMIT);
+            }
+
+            ~thread_cache() {
+                for (size_t i = 0; i < CLASS_COUNT; i++)
+                    get_depot().release(i, blocks[i], blocks[i].size());
+            }
+        };
+
+        static depot& get_depot() {
+            static depot d;
+            return d;
+        }
+
+        static thread_cache& local_cache() {
+            static thread_local thread_cache cache;
+            return cache;
+        }
+    };
+
+    // Stateless allocator drawing from buffer_pool, used for message bodies.
+    template <typename U>
+    struct pool_allocator {
+        using value_type = U;
+
+        pool_allocator() = default;
+        template <typename V>
+        pool_allocator(const pool_allocator<V>&) noexcept { }
+
+        template <typename V>
+        struct rebind {
+            using other = pool_allocator<V>;
+        };
+
+        U* allocate(size_t n) {
+            return static_cast<U*>(buffer_pool::allocate(n * sizeof(U)));
+        }
+
+        void deallocate(U* p, size_t n) noexcept {
+            buffer_pool::deallocate(p, n * sizeof(U));
+        }
+
+        template <typename V>
+        bool operator==(const pool_allocator<V>&) const noexcept { return true; }
+    };
+
+    // Attaches pool_allocator to an asio completion handler, so the operation state asio allocates for it
+    // is recycled through buffer_pool as well, whichever thread initiates the operation.
+    template <typename Handler>
+    struct pooled_handler {
+        using allocator_type = pool_allocator<void>;
+
+        Handler handler;
+
+        allocator_type get_allocator() const noexcept {
+            return {};
+        }
+
+        template <typename... Args>
+        void operator()(Args&&... args) {
+            handler(std::forward<Args>(args)...);
+        }
+    };
+
+    template <typename Handler>
+    pooled_handler<std::decay_t<Handler>> make_pooled_handler(Handler&& handler) {
+        return { std::forward<Handler>(handler) };
+    }
+}
+
+#endif //NETCLIENT_NET_BUFFER_POOL_H
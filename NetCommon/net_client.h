@@ -4,13 +4,26 @@
 #include "net_common.h"
 #include "net_message.h"
 #include "net_tsqueue.h"
+#include "net_mpsc_queue.h"
 #include "net_connection.h"
+#include "net_udp.h"
+#include "net_log.h"
 
 namespace blcl::net {
     template<typename T>
     class client_interface {
     public:
-        client_interface(): socket_(context_) {
+        client_interface(): owned_context_(std::make_unique<asio::io_context>()), context_(*owned_context_),
+            socket_(context_), udp_bind_timer_(context_)
+        {
+
+        }
+
+        // Runs on a caller-owned io_context instead of a thread of its own, so many clients can share a pool.
+        // The caller runs the context and must stop it before destroying the client.
+        explicit client_interface(asio::io_context& context, size_t queue_capacity = mpsc_queue<owned_message<T>>::DEFAULT_CAPACITY)
+            : context_(context), socket_(context_), udp_bind_timer_(context_), incoming_messages_(queue_capacity)
+        {
 
         }
 
@@ -19,31 +32,58 @@ namespace blcl::net {
         }
 
     public:
-        bool connect(const std::string& host, const uint16_t port) {
-            try {
-                asio::ip::tcp::resolver resolver(context_);
-                auto endpoints = resolver.resolve(host, std::to_string(port));
+        // Compresses outgoing bodies of at least threshold bytes if the server can take them. Call before connect().
+        void enable_compression(size_t threshold = 1024) {
+            compression_threshold_ = threshold;
+        }
 
-                connection_ = std::make_unique<connection<T>>(
-                        connection<T>::owner::client, context_, asio::ip::tcp::socket(context_), incoming_messages_);
-                connection_->connect_to_server(endpoints);
-                ctx_thread_ = std::thread([this]() { context_.run(); });
-            } catch (std::exception& e) {
-                std::cerr << "Client exception: " << e.what() << '\n';
-                return false;
-            }
+        // Disconnects from a server that sends a message body larger than max_bytes. Call before connect().
+        void set_max_message_size(size_t max_bytes) {
+            max_message_size_ = max_bytes;
+        }
 
-            return false;
+        // Delivers incoming messages to receive() rather than get_incoming_messages(). Call before connect().
+        void enable_direct_receive() {
+            direct_receive_ = true;
+        }
+
+        // With unreliable_channel, a UDP channel to the same port is bound to the session once the handshake is done;
+        // until then send_unreliable() goes over TCP.
+        bool connect(const std::string& host, const uint16_t port, bool unreliable_channel = false) {
+            return open(host, port, unreliable_channel, { 0, 0 });
+        }
+
+        // Connects to the server of the last connect() again, after disconnect() or once the connection has dropped.
+        // If the server still holds the last session, this resumes it: get_session() keeps its ID, and whatever the
+        // server had sent or queued that never arrived comes in ahead of anything new. Otherwise it starts a new one,
+        // and get_session().resumed is 0.
+        bool reconnect() {
+            disconnect();
+            return open(host_, port_, unreliable_channel_, resume_point_);
         }
 
         void disconnect() {
             if (is_connected())
                 connection_->disconnect();
 
-            context_.stop();
-            if (ctx_thread_.joinable())
-                ctx_thread_.join();
-            connection_.release();
+            if (owned_context_) {
+                work_guard_.reset();
+                context_.stop();
+                if (ctx_thread_.joinable())
+                    ctx_thread_.join();
+                // Run what stop() cut short, the close posted above among it, so the server sees the socket go.
+                context_.restart();
+                context_.poll();
+            }
+            // Handlers still pending on a caller-owned context hold the connection until they have run.
+            if (connection_)
+                resume_point_ = connection_->get_resume_point();
+            connection_.reset();
+        }
+
+        // Issued by the server after the challenge-response; all zero until then.
+        session_info get_session() const {
+            return connection_ ? connection_->get_session() : session_info {};
         }
 
         bool is_connected() {
@@ -59,16 +99,185 @@ namespace blcl::net {
                 connection_->send(msg);
         }
 
-        tsqueue<owned_message<T>>& get_incoming_messages() {
+        void send(message<T>&& msg) {
+            if (is_connected())
+                connection_->send(std::move(msg));
+        }
+
+        // Awaitable counterparts of get_incoming_messages() and send(), see connection::receive() and
+        // connection::async_send(). Spawn the coroutine using them on get_executor(). Only valid after connect().
+        auto get_executor() {
+            return connection_->get_executor();
+        }
+
+        asio::awaitable<message<T>> receive() {
+            return connection_->receive();
+        }
+
+        asio::awaitable<void> async_send(message<T> msg, priority lane = priority::normal) {
+            return connection_->async_send(std::move(msg), lane);
+        }
+
+        // Latest-wins delivery over UDP, falling back to send() until the UDP channel is bound.
+        void send_unreliable(const message<T>& msg) {
+            if (!is_connected())
+                return;
+            if (!udp_bound_.load(std::memory_order_acquire) || !udp_channel<T>::fits(msg)) {
+                connection_->send(msg);
+                return;
+            }
+
+            session_info session = get_udp_session();
+            udp_header header { session.id, udp_sequence_.fetch_add(1, std::memory_order_relaxed) + 1, session.token };
+            udp_->send_to(server_udp_endpoint_, header, &msg);
+        }
+
+        bool is_unreliable_channel_bound() const {
+            return udp_bound_.load(std::memory_order_acquire);
+        }
+
+        udp_channel<T>* get_unreliable_channel() {
+            return udp_.get();
+        }
+
+        connection_stats get_stats() const {
+            return connection_ ? connection_->get_stats() : connection_stats();
+        }
+
+        mpsc_queue<owned_message<T>>& get_incoming_messages() {
             return incoming_messages_;
         }
+
+    private:
+        static constexpr auto UDP_BIND_INTERVAL = std::chrono::milliseconds(100);
+
+        bool open(const std::string& host, const uint16_t port, bool unreliable_channel, std::pair<uint64_t, uint64_t> resume_point) {
+            host_ = host;
+            port_ = port;
+            unreliable_channel_ = unreliable_channel;
+            try {
+                asio::ip::tcp::resolver resolver(context_);
+                auto endpoints = resolver.resolve(host, std::to_string(port));
+
+                connection_ = std::make_shared<connection<T>>(
+                        connection<T>::owner::client, context_, asio::ip::tcp::socket(context_), incoming_messages_);
+                connection_->set_compression(compression_threshold_);
+                connection_->set_direct_receive(direct_receive_);
+                connection_->set_max_message_size(max_message_size_);
+                connection_->set_resume_point(resume_point.first, resume_point.second);
+                connection_->connect_to_server(endpoints);
+                if (unreliable_channel) {
+                    // The new connection has to bind its session again.
+                    udp_bound_.store(false, std::memory_order_release);
+                    udp_port_ = port;
+                    bind_udp(connection_);
+                }
+                if (owned_context_) {
+                    // A connection whose reads are paused for receive() has nothing pending; keep the thread anyway.
+                    context_.restart();
+                    work_guard_.emplace(context_.get_executor());
+                    ctx_thread_ = std::thread([this]() { context_.run(); });
+                }
+            } catch (std::exception& e) {
+                log_error("Client exception: {}", e.what());
+                return false;
+            }
+
+            return true;
+        }
+
+        // async
+        // Keeps sending bind requests for conn until the server acknowledges one. The session and the endpoint are
+        // read on conn's strand, where the handshake writes them.
+        void bind_udp(std::shared_ptr<connection<T>> conn) {
+            udp_bind_timer_.expires_after(UDP_BIND_INTERVAL);
+            udp_bind_timer_.async_wait([this, conn = std::move(conn)](std::error_code ec) mutable {
+                if (ec || udp_bound_.load(std::memory_order_acquire) || !conn->is_connected())
+                    return;
+
+                auto strand = conn->get_executor();
+                asio::post(strand, make_pooled_handler([this, conn = std::move(conn)]() mutable {
+                    const session_info& session = conn->get_session();
+                    if (session.token != 0 && open_udp(*conn)) {
+                        {
+                            std::scoped_lock lock(udp_session_mtx_);
+                            udp_session_ = session;
+                        }
+                        udp_->send_to(server_udp_endpoint_, { session.id, 0, session.token });
+                    }
+                    bind_udp(std::move(conn));
+                }));
+            });
+        }
+
+        // Creates the UDP channel on the first bind, towards the address conn is connected to.
+        bool open_udp(const connection<T>& conn) {
+            if (udp_)
+                return true;
+
+            asio::error_code ec;
+            auto endpoint = conn.get_endpoint(ec);
+            if (ec)
+                return false;
+            server_udp_endpoint_ = asio::ip::udp::endpoint(endpoint.address(), udp_port_);
+            udp_ = std::make_unique<udp_channel<T>>(context_, asio::ip::udp::endpoint(server_udp_endpoint_.protocol(), 0),
+                [this](const asio::ip::udp::endpoint& sender, const udp_header& header, const uint8_t* payload, size_t size) {
+                    on_udp_datagram(sender, header, payload, size);
+                });
+            udp_->start();
+            return true;
+        }
+
+        // The session the UDP channel was last bound for.
+        session_info get_udp_session() {
+            std::scoped_lock lock(udp_session_mtx_);
+            return udp_session_;
+        }
+
+        void on_udp_datagram(const asio::ip::udp::endpoint& sender, const udp_header& header, const uint8_t* payload, size_t size) {
+            session_info session = get_udp_session();
+            if (sender != server_udp_endpoint_ || header.session_id != session.id || !session_tokens_equal(header.token, session.token))
+                return;
+
+            if (size == 0) {
+                // A new session's datagrams are numbered afresh; a resumed one's carry on.
+                if (!udp_bound_.exchange(true, std::memory_order_acq_rel) && !session.resumed)
+                    udp_filter_.reset();
+                return;
+            }
+
+            // Dropped if the queue is full, like any datagram; this runs on the I/O thread, which mustn't wait for room.
+            message<T> msg;
+            if (udp_channel<T>::decode(payload, size, msg) && udp_filter_.accept(msg.header.id, header.sequence))
+                incoming_messages_.try_push_back({ nullptr, std::move(msg) });
+        }
+
     protected:
-        asio::io_context context_;
+        std::unique_ptr<asio::io_context> owned_context_;
+        asio::io_context& context_;
         std::thread ctx_thread_;
+        std::optional<asio::executor_work_guard<asio::io_context::executor_type>> work_guard_;
         asio::ip::tcp::socket socket_;
-        std::unique_ptr<connection<T>> connection_;
+        std::shared_ptr<connection<T>> connection_;
+        std::unique_ptr<udp_channel<T>> udp_;
+        asio::steady_timer udp_bind_timer_;
+        asio::ip::udp::endpoint server_udp_endpoint_;
+        uint16_t udp_port_ = 0;
+        std::atomic<bool> udp_bound_ { false };
+        std::atomic<uint32_t> udp_sequence_ { 0 };
+        udp_sequence_filter<T> udp_filter_;
+        std::mutex udp_session_mtx_;
+        session_info udp_session_;
+        size_t compression_threshold_ = 0;
+        bool direct_receive_ = false;
+        size_t max_message_size_ = DEFAULT_MAX_MESSAGE_SIZE;
+        std::string host_;
+        uint16_t port_ = 0;
+        bool unreliable_channel_ = false;
+        // Token and received count of the last connection's session, for reconnect().
+        std::pair<uint64_t, uint64_t> resume_point_ { 0, 0 };
     private:
-        tsqueue<owned_message<T>> incoming_messages_;
+        mpsc_queue<owned_message<T>> incoming_messages_;
     };
 }
 
@@ -12,5 +12,7 @@
 #include <asio/ts/internet.hpp>
 
 constexpr uint32_t MAX_MSG_SIZE = 512;
+// Largest message body a connection accepts unless told otherwise; a peer that sends more is disconnected.
+constexpr size_t DEFAULT_MAX_MESSAGE_SIZE = 1024 * 1024;
 
 #endif //SIMPLENETWORKING_NET_COMMON_H
@@ -0,0 +1,109 @@
+#ifndef NETCLIENT_NET_COMPLETION_H
+#define NETCLIENT_NET_COMPLETION_H
+
+#include "net_common.h"
+#include "net_buffer_pool.h"
+#include <tuple>
+#include <utility>
+
+namespace blcl::net {
+    // Holds the completion handler of an asynchronous operation until some other handler produces its result,
+    // as void(asio::error_code, Args...). The handler is type-erased into a block from buffer_pool, so a
+    // coroutine awaiting the operation costs no heap allocation. Not synchronized.
+    template <typename... Args>
+    class completion_slot {
+    public:
+        completion_slot() = default;
+
+        completion_slot(completion_slot&& other) noexcept: op_(std::exchange(other.op_, nullptr)) {
+
+        }
+
+        completion_slot& operator=(completion_slot&& other) noexcept {
+            if (this != &other) {
+                reset();
+                op_ = std::exchange(other.op_, nullptr);
+            }
+            return *this;
+        }
+
+        ~completion_slot() {
+            reset();
+        }
+
+        template <typename Handler>
+        void set(Handler&& handler) {
+            reset();
+            using op_type = operation<std::decay_t<Handler>>;
+            op_ = new (buffer_pool::allocate(sizeof(op_type))) op_type(std::forward<Handler>(handler));
+        }
+
+        explicit operator bool() const {
+            return op_ != nullptr;
+        }
+
+        // Runs the handler on its associated executor, right away if the caller is already running there.
+        // The handler may start the next operation on this slot before dispatch() returns.
+        void dispatch(asio::error_code ec, Args... args) {
+            if (base* op = std::exchange(op_, nullptr))
+                op->complete(op, false, ec, std::forward<Args>(args)...);
+        }
+
+        // Queues the handler on its associated executor; for completing from a context that must not be re-entered.
+        void post(asio::error_code ec, Args... args) {
+            if (base* op = std::exchange(op_, nullptr))
+                op->complete(op, true, ec, std::forward<Args>(args)...);
+        }
+
+        // Drops the handler without running it.
+        void reset() {
+            if (base* op = std::exchange(op_, nullptr))
+                op->destroy(op);
+        }
+
+    private:
+        struct base {
+            void (*complete)(base*, bool, asio::error_code, Args&&...);
+            void (*destroy)(base*);
+        };
+
+        template <typename Handler>
+        struct operation: base {
+            Handler handler;
+
+            explicit operation(Handler&& h): base { &do_complete, &do_destroy }, handler(std::move(h)) {
+
+            }
+
+            explicit operation(const Handler& h): base { &do_complete, &do_destroy }, handler(h) {
+
+            }
+
+            static void do_complete(base* b, bool defer, asio::error_code ec, Args&&... args) {
+                auto* op = static_cast<operation*>(b);
+                // Free the block before the upcall, which may well start the next operation.
+                Handler handler(std::move(op->handler));
+                do_destroy(op);
+                auto executor = asio::get_associated_executor(handler);
+                auto upcall = make_pooled_handler(
+                        [handler = std::move(handler), ec, args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                            std::apply([&](auto&&... a) { handler(ec, std::move(a)...); }, std::move(args));
+                        });
+                if (defer)
+                    asio::post(executor, std::move(upcall));
+                else
+                    asio::dispatch(executor, std::move(upcall));
+            }
+
+            static void do_destroy(base* b) {
+                auto* op = static_cast<operation*>(b);
+                op->~operation();
+                buffer_pool::deallocate(op, sizeof(operation));
+            }
+        };
+
+        base* op_ = nullptr;
+    };
+}
+
+#endif //NETCLIENT_NET_COMPLETION_H
@@ -0,0 +1,232 @@
+#ifndef NETCLIENT_NET_COMPRESSION_H
+#define NETCLIENT_NET_COMPRESSION_H
+
+#include "net_common.h"
+#include "net_message.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace blcl::net {
+    // Set in message_header::size when the body is compressed: a uint32 original size followed by an LZ block.
+    constexpr uint32_t COMPRESSED_FLAG = 0x80000000u;
+
+    // Largest body a compressed frame may expand to; anything claiming more is treated as malformed.
+    constexpr size_t MAX_DECOMPRESSED_SIZE = 16 * 1024 * 1024;
+
+    // Byte-oriented LZ77 in the LZ4 block format: greedy matching over a 4-byte hash table, 64 KiB window.
+    namespace lz {
+        constexpr size_t MIN_MATCH = 4;
+        // The format requires the last 5 bytes to be literals and a match to start at least 12 bytes before the end.
+        constexpr size_t LAST_LITERALS = 5;
+        constexpr size_t MATCH_FIND_LIMIT = 12;
+        constexpr size_t MAX_OFFSET = 65535;
+        constexpr int HASH_BITS = 12;
+
+        constexpr size_t compress_bound(size_t size) {
+            return size + size / 255 + 16;
+        }
+
+        // Upper bound on what a block of size bytes can expand to: no byte of it adds more than 255 to the output.
+        constexpr size_t decompress_bound(size_t size) {
+            return size * 255;
+        }
+
+        inline uint32_t read32(const uint8_t* p) {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline uint32_t hash(uint32_t v) {
+            return (v * 2654435761u) >> (32 - HASH_BITS);
+        }
+
+        inline uint8_t* write_length(uint8_t* out, size_t length) {
+            for (; length >= 255; length -= 255)
+                *out++ = 255;
+            *out++ = uint8_t(length);
+            return out;
+        }
+
+        inline bool read_length(const uint8_t*& in, const uint8_t* end, size_t& length) {
+            uint8_t byte;
+            do {
+                if (in >= end)
+                    return false;
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+            return true;
+        }
+
+        // Emits one sequence: literals [anchor, anchor + literals), then a match unless match_length is 0 (last one).
+        inline uint8_t* write_sequence(uint8_t* out, const uint8_t* anchor, size_t literals, size_t offset, size_t match_length) {
+            uint8_t* token = out++;
+            *token = uint8_t((literals >= 15 ? 15 : literals) << 4);
+            if (literals >= 15)
+                out = write_length(out, literals - 15);
+            if (literals > 0)
+                std::memcpy(out, anchor, literals);
+            out += literals;
+            if (match_length == 0)
+                return out;
+
+            *out++ = uint8_t(offset);
+            *out++ = uint8_t(offset >> 8);
+            size_t length = match_length - MIN_MATCH;
+            *token |= uint8_t(length >= 15 ? 15 : length);
+            if (length >= 15)
+                out = write_length(out, length - 15);
+            return out;
+        }
+
+        // Returns the compressed size, or 0 if it would not fit in capacity.
+        inline size_t compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity) {
+            uint8_t* out = dst;
+            const uint8_t* anchor = src;
+            const uint8_t* end = src + size;
+
+            if (size > MATCH_FIND_LIMIT) {
+                std::array<uint32_t, 1 << HASH_BITS> table {};
+                const uint8_t* match_limit = end - MATCH_FIND_LIMIT;
+                const uint8_t* extend_limit = end - LAST_LITERALS;
+                const uint8_t* ip = src + 1;
+                // Step further the longer nothing matches, so incompressible input is given up on quickly.
+                size_t misses = 0;
+                while (ip < match_limit) {
+                    uint32_t sequence = read32(ip);
+                    uint32_t& slot = table[hash(sequence)];
+                    const uint8_t* ref = src + slot;
+                    slot = uint32_t(ip - src);
+                    if (ref >= ip || size_t(ip - ref) > MAX_OFFSET || read32(ref) != sequence) {
+                        ip += 1 + (misses++ >> 5);
+                        continue;
+                    }
+                    misses = 0;
+
+                    const uint8_t* match_end = ip + MIN_MATCH;
+                    const uint8_t* ref_end = ref + MIN_MATCH;
+                    while (match_end < extend_limit && *match_end == *ref_end) {
+                        match_end++;
+                        ref_end++;
+                    }
+
+                    size_t literals = size_t(ip - anchor);
+                    size_t match_length = size_t(match_end - ip);
+                    if (size_t(dst + capacity - out) < 1 + literals + literals / 255 + 3 + match_length / 255 + 1)
+                        return 0;
+                    out = write_sequence(out, anchor, literals, size_t(ip - ref), match_length);
+                    ip = match_end;
+                    anchor = ip;
+                }
+            }
+
+            size_t literals = size_t(end - anchor);
+            if (size_t(dst + capacity - out) < 1 + literals + literals / 255 + 1)
+                return 0;
+            out = write_sequence(out, anchor, literals, 0, 0);
+            return size_t(out - dst);
+        }
+
+        // Expands exactly size bytes into dst; false on any malformed or out-of-bounds input.
+        inline bool decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t size) {
+            const uint8_t* in = src;
+            const uint8_t* end = src + src_size;
+            uint8_t* out = dst;
+            uint8_t* out_end = dst + size;
+
+            while (in < end) {
+                uint8_t token = *in++;
+                size_t literals = token >> 4;
+                if (literals == 15 && !read_length(in, end, literals))
+                    return false;
+                if (size_t(end - in) < literals || size_t(out_end - out) < literals)
+                    return false;
+                if (literals > 0)
+                    std::memcpy(out, in, literals);
+                in += literals;
+                out += literals;
+                if (in == end)
+                    break;
+
+                if (end - in < 2)
+                    return false;
+                size_t offset = size_t(in[0]) | size_t(in[1]) << 8;
+                in += 2;
+                if (offset == 0 || offset > size_t(out - dst))
+                    return false;
+                size_t match_length = token & 15;
+                if (match_length == 15 && !read_length(in, end, match_length))
+                    return false;
+                match_length += MIN_MATCH;
+                if (size_t(out_end - out) < match_length)
+                    return false;
+
+                const uint8_t* ref = out - offset;
+                if (offset >= match_length) {
+                    std::memcpy(out, ref, match_length);
+                } else {
+                    // Overlapping match, e.g. a run: copy forward byte by byte.
+                    for (size_t i = 0; i < match_length; i++)
+                        out[i] = ref[i];
+                }
+                out += match_length;
+            }
+            return out == out_end;
+        }
+    }
+
+    // Fills out with the compressed form of msg and returns true, or returns false if that would save less than 1/16.
+    template <typename T>
+    bool compress_message(const message<T>& msg, message<T>& out) {
+        size_t size = msg.body.size();
+        thread_local std::vector<uint8_t> scratch;
+        if (scratch.size() < sizeof(uint32_t) + lz::compress_bound(size))
+            scratch.resize(sizeof(uint32_t) + lz::compress_bound(size));
+
+        uint32_t original = uint32_t(size);
+        std::memcpy(scratch.data(), &original, sizeof(uint32_t));
+        size_t packed = lz::compress(msg.body.data(), size, scratch.data() + sizeof(uint32_t), scratch.size() - sizeof(uint32_t));
+        if (packed == 0 || sizeof(uint32_t) + packed > size - size / 16)
+            return false;
+
+        out.header.id = msg.header.id;
+        out.body.assign(scratch.data(), scratch.data() + sizeof(uint32_t) + packed);
+        out.header.size = uint32_t(out.body.size()) | COMPRESSED_FLAG;
+        return true;
+    }
+
+    // The compressed form of msg, shared by every connection that sends it and worked out by the first of them;
+    // null if compressing msg doesn't pay.
+    template <typename T>
+    const shared_message<T>& compressed_form(const shared_message<T>& msg) {
+        std::call_once(msg->packed_once, [&msg]() {
+            message<T> packed;
+            if (compress_message<T>(*msg, packed))
+                msg->packed = make_shared_message(std::move(packed));
+        });
+        return msg->packed;
+    }
+
+    // Expands a body written by compress_message into msg, whose header.size becomes the original size. The size
+    // the body claims is checked against max_size and against what its block could possibly expand to before
+    // anything is allocated for it.
+    template <typename T>
+    bool decompress_body(const uint8_t* body, size_t size, message<T>& msg, size_t max_size = MAX_DECOMPRESSED_SIZE) {
+        uint32_t original;
+        if (size < sizeof(uint32_t))
+            return false;
+        std::memcpy(&original, body, sizeof(uint32_t));
+        if (original > std::min(max_size, MAX_DECOMPRESSED_SIZE) || original > lz::decompress_bound(size - sizeof(uint32_t)))
+            return false;
+
+        msg.body.resize(original);
+        if (!lz::decompress(body + sizeof(uint32_t), size - sizeof(uint32_t), msg.body.data(), original))
+            return false;
+        msg.header.size = original;
+        return true;
+    }
+}
+
+#endif //NETCLIENT_NET_COMPRESSION_H
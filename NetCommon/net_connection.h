@@ -3,12 +3,43 @@
 
 #include "net_common.h"
 #include "net_tsqueue.h"
+#include "net_mpsc_queue.h"
 #include "net_message.h"
+#include "net_udp.h"
+#include "net_compression.h"
+#include "net_stats.h"
+#include "net_log.h"
+#include "net_completion.h"
+#include <limits>
+#include <optional>
+#include <span>
 
 namespace blcl::net {
     template<typename T>
     class server_interface;
 
+    // What a connection does with a message sent while its outgoing queue is at its limits.
+    enum class overflow_policy {
+        // Discard the oldest messages not yet being written, lowest priority lane first, until the new one fits.
+        drop_oldest,
+        // Discard the new message.
+        drop_newest,
+        // Replace the newest message with the same id queued in the same lane, keeping its place; drop_oldest if none.
+        // Only for ids whose every message supersedes the last, which rules out server_interface::flush_snapshot().
+        coalesce,
+        // Close the connection.
+        disconnect
+    };
+
+    // Bounds on one connection's outgoing queue. Bytes count whole frames, including those being written. 0 means no limit.
+    struct outgoing_limits {
+        size_t max_messages = 0;
+        size_t max_bytes = 0;
+        overflow_policy policy = overflow_policy::drop_oldest;
+        // would_block() turns true once this many bytes are queued and false again below half of it.
+        size_t high_watermark = 0;
+    };
+
     template<typename T>
     class connection: public std::enable_shared_from_this<connection<T>> {
     public:
@@ -17,14 +48,17 @@ namespace blcl::net {
             client
         };
 
-        connection(owner parent, asio::io_context& asio_context, asio::ip::tcp::socket socket, tsqueue<owned_message<T>>& incoming_messages)
-            : asio_context_(asio_context), socket_(std::move(socket)), incoming_messages_(incoming_messages),
-            owner_type_(parent)
+        connection(owner parent, asio::io_context& asio_context, asio::ip::tcp::socket socket, mpsc_queue<owned_message<T>>& incoming_messages)
+            : asio_context_(asio_context),
+            strand_(asio::make_strand(asio::require(asio_context.get_executor(), asio::execution::allocator(pool_allocator<void>())))),
+            socket_(std::move(socket)), cork_timer_(strand_), notice_timer_(strand_), stall_timer_(strand_), incoming_messages_(incoming_messages), owner_type_(parent), park_timer_(strand_)
         {
             owner_type_ = parent;
             if (owner_type_ == owner::server) {
                 checksum_out_ = uint64_t(std::chrono::system_clock::now().time_since_epoch().count());
                 expected_checksum_ = encode(checksum_out_);
+                session_.token = make_session_token();
+                session_.capabilities = LOCAL_CAPABILITIES & ~CAP_RESUME;
             } else {
                 checksum_in_ = 0;
                 checksum_out_ = 0;
@@ -37,6 +71,11 @@ namespace blcl::net {
             return id_;
         }
 
+        // Issued by the server once the challenge-response passes; the client learns it right after.
+        const session_info& get_session() const {
+            return session_;
+        }
+
         bool is_validated() const {
             return validated_;
         }
@@ -45,12 +84,25 @@ namespace blcl::net {
             return socket_.remote_endpoint();
         }
 
+        asio::ip::tcp::socket::endpoint_type get_endpoint(asio::error_code& ec) const {
+            return socket_.remote_endpoint(ec);
+        }
+
         void connect_to_client(blcl::net::server_interface<T>* server, uint32_t uid = 0) {
             if (owner_type_ == owner::server) {
                 if (socket_.is_open()) {
+                    server_ = server;
                     id_ = uid;
-                    write_validation();
-                    read_validation(server);
+                    session_.id = uid;
+                    last_received_.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+                    disable_nagle();
+                    // Called from the acceptor's thread; hand the handshake over to this connection's strand.
+                    // The client's answer is read as the start of the message stream, so whatever the client
+                    // sent right behind it comes up in the same read.
+                    asio::post(strand_, make_pooled_handler([this, self = keep_alive()]() {
+                        write_validation();
+                        read_messages();
+                    }));
 //                    read_header();
                 }
             }
@@ -59,117 +111,937 @@ namespace blcl::net {
         void connect_to_server(const asio::ip::tcp::resolver::results_type& endpoints) {
             if (owner_type_ == owner::client) {
                 asio::async_connect(socket_, endpoints,
-                    [this](std::error_code ec, const asio::ip::tcp::endpoint& endpoint) {
+                    asio::bind_executor(strand_, make_pooled_handler([this, self = keep_alive()](std::error_code ec, const asio::ip::tcp::endpoint& endpoint) {
                         if (!ec) {
 //                            read_header();
+                            disable_nagle();
                             read_validation();
                         }
-                });
+                })));
             }
         }
 
         void disconnect() {
             if (is_connected())
-                asio::post(asio_context_, [this]() { socket_.close(); });
+                asio::post(strand_, make_pooled_handler([this, self = keep_alive()]() { close(); }));
+        }
+
+        // Called by the server's heartbeat wheel, from any thread. Pings a peer that has been silent for keepalive
+        // and closes the connection once it has been silent for idle_timeout; a zero duration turns either off.
+        // Returns when to check again, or nothing once the connection is closed.
+        std::optional<std::chrono::steady_clock::time_point> check_liveness(std::chrono::steady_clock::time_point now,
+                std::chrono::steady_clock::duration keepalive, std::chrono::steady_clock::duration idle_timeout) {
+            if (!is_connected())
+                return std::nullopt;
+
+            auto last = std::chrono::steady_clock::time_point(
+                    std::chrono::steady_clock::duration(last_received_.load(std::memory_order_relaxed)));
+            if (idle_timeout.count() > 0 && now - last >= idle_timeout) {
+                asio::post(strand_, make_pooled_handler([this, self = keep_alive(), idle = now - last]() {
+                    log_info("{}: Closing idle connection, nothing received for {} ms.", id_,
+                             std::chrono::duration_cast<std::chrono::milliseconds>(idle).count());
+                    close();
+                }));
+                return std::nullopt;
+            }
+
+            auto next = std::chrono::steady_clock::time_point::max();
+            if (keepalive.count() > 0) {
+                if (!heartbeat_peer_.load(std::memory_order_relaxed)) {
+                    // Handshake not done yet, or a peer that can't answer pings.
+                    next = now + keepalive;
+                } else if (now - last >= keepalive) {
+                    send_control(control_frame::ping);
+                    next = now + keepalive;
+                } else {
+                    next = last + keepalive;
+                }
+            }
+            if (idle_timeout.count() > 0)
+                next = std::min(next, last + idle_timeout);
+            return next;
         }
 
         bool is_connected() const {
             return socket_.is_open();
         }
 
-        void send(const message<T>& msg) {
-            asio::post(asio_context_,
-                [this, msg]() {
-                    bool writing_message = !outgoing_messages_.empty();
-                    outgoing_messages_.push_back(msg);
-                    if (!writing_message)
-                        write_header();
-            });
+        void send(const message<T>& msg, priority lane = priority::normal) {
+            send(message<T>(msg), lane);
+        }
+
+        void send(message<T>&& msg, priority lane = priority::normal) {
+            enqueue_outgoing({ std::move(msg), nullptr, lane });
+        }
+
+        // Queues a reference to msg rather than a copy; used to fan the same message out to many connections.
+        void send(shared_message<T> msg, priority lane = priority::normal) {
+            enqueue_outgoing({ {}, std::move(msg), lane });
+        }
+
+        // Delivers incoming messages to receive() instead of the shared incoming queue. Call before the handshake starts.
+        void set_direct_receive(bool enabled) {
+            direct_receive_ = enabled;
+        }
+
+        // The connection's strand. A coroutine spawned on it runs serialized with the connection's own handlers.
+        auto get_executor() const {
+            return strand_;
         }
 
-    private:
         // async
-        void read_header() {
-            asio::async_read(socket_, asio::buffer(&current_incoming_message_.header, sizeof(message_header<T>)),
-                [this](std::error_code ec, std::size_t length) {
-                    if (!ec) {
-                        if (current_incoming_message_.header.size > 0) {
-                            // Assert if msg size is gonna exceed MAX_MSG_SIZE. If so, log it (for now).
-                            if (current_incoming_message_.header.size > MAX_MSG_SIZE) {
-                                std::cout << "[WARN]: " << "A message exceeded MAX_MSG_SIZE = " << MAX_MSG_SIZE << "." << std::endl
-                                          << "[WARN]: It's gonna allocate " << current_incoming_message_.header.size << "bytes." << std::endl
-                                          << "[WARN]: Its ID: " << (uint32_t) current_incoming_message_.header.id << std::endl;
-                            }
-                            current_incoming_message_.body.resize(current_incoming_message_.header.size);
-                            read_body();
-                        } else {
-                            add_to_incoming_messages_queue();
+        // Next incoming message, with set_direct_receive() on; throws asio::system_error (eof) once the connection
+        // is closed and everything read before that has been received. A coroutine running on get_executor()
+        // that waits here is resumed right from the read handler, with no queue or thread in between. Messages
+        // nobody waits for are buffered, and reading pauses at DIRECT_INBOX_LIMIT of them.
+        // One receive() may be pending at a time.
+        asio::awaitable<message<T>> receive() {
+            return asio::async_initiate<decltype(asio::use_awaitable), void(asio::error_code, message<T>)>(
+                [this, self = keep_alive()](auto handler) mutable {
+                    asio::dispatch(strand_, make_pooled_handler([this, self = std::move(self), handler = std::move(handler)]() mutable {
+                        receiver_.set(std::move(handler));
+                        if (!inbox_.empty()) {
+                            message<T> msg = std::move(inbox_.front());
+                            inbox_.pop_front();
+                            resume_reading();
+                            receiver_.post({}, std::move(msg));
+                        } else if (closed_) {
+                            receiver_.post(asio::error::eof, {});
                         }
-                    } else {
-                        std::cout << "[WARN] " << id_ << ": Read header failed.\n";
-                        std::cout << "[WARN] " << id_ << ": " << ec.message() << "\n";
-                        socket_.close();
-                    }
-            });
+                    }));
+                }, asio::use_awaitable);
         }
 
         // async
-        void read_body() {
-            asio::async_read(socket_, asio::buffer(current_incoming_message_.body.data(), current_incoming_message_.size()),
-                [this](std::error_code ec, std::size_t length) {
+        // Queues msg like send(), then waits while the outgoing queue is above its high watermark, so a coroutine
+        // producing faster than the peer reads is held to the socket's pace rather than running into the overflow
+        // policy. Throws asio::system_error (not_connected) if the connection is closed.
+        asio::awaitable<void> async_send(message<T> msg, priority lane = priority::normal) {
+            return asio::async_initiate<decltype(asio::use_awaitable), void(asio::error_code)>(
+                [this, self = keep_alive(), item = outgoing_message<T> { std::move(msg), nullptr, lane }](auto handler) mutable {
+                    asio::dispatch(strand_, make_pooled_handler(
+                        [this, self = std::move(self), item = std::move(item), handler = std::move(handler)]() mutable {
+                            completion_slot<> waiter;
+                            waiter.set(std::move(handler));
+                            queue_outgoing(std::move(item));
+                            if (closed_)
+                                waiter.post(asio::error::not_connected);
+                            else if (congested_.load(std::memory_order_relaxed))
+                                send_waiters_.push_back(std::move(waiter));
+                            else
+                                waiter.post({});
+                    }));
+                }, asio::use_awaitable);
+        }
+
+        // Server side: lets send_unreliable() use the server's UDP channel once the client has bound an endpoint to it.
+        void attach_udp(udp_channel<T>* udp) {
+            udp_ = udp;
+        }
+
+        void bind_udp_endpoint(const asio::ip::udp::endpoint& endpoint) {
+            std::scoped_lock lock(udp_mtx_);
+            udp_endpoint_ = endpoint;
+            udp_bound_ = true;
+        }
+
+        bool is_udp_bound() {
+            std::scoped_lock lock(udp_mtx_);
+            return udp_bound_;
+        }
+
+        // Server side, from any thread, such as the UDP channel's: whether token is this connection's session token.
+        bool has_session_token(uint64_t token) {
+            std::scoped_lock lock(udp_mtx_);
+            return session_tokens_equal(session_.token, token);
+        }
+
+        // Latest-wins delivery over UDP. Falls back to send() while no UDP endpoint is bound or if msg is too big
+        // for one datagram. Safe to call from any thread.
+        void send_unreliable(const message<T>& msg) {
+            asio::ip::udp::endpoint endpoint;
+            udp_header header;
+            {
+                std::scoped_lock lock(udp_mtx_);
+                if (!udp_ || !udp_bound_ || !udp_channel<T>::fits(msg)) {
+                    send(msg);
+                    return;
+                }
+                endpoint = udp_endpoint_;
+                header = { session_.id, udp_sequence_.fetch_add(1, std::memory_order_relaxed) + 1, session_.token };
+            }
+            udp_->send_to(endpoint, header, &msg);
+        }
+
+        // Only called from the thread running the UDP channel's receive loop.
+        bool accept_udp_sequence(T id, uint32_t sequence) {
+            return udp_filter_.accept(id, sequence);
+        }
+
+        // Bodies of at least threshold bytes are compressed on the way out if the peer advertised CAP_COMPRESSION
+        // and it saves enough; 0 turns it off. Call before the handshake starts.
+        void set_compression(size_t threshold) {
+            compression_threshold_ = threshold;
+        }
+
+        // Queued messages are coalesced into one gathered write of up to max_messages / max_bytes.
+        // A non-zero cork_delay holds a lone small write back that long so later messages can share its send.
+        void set_write_batching(size_t max_messages, size_t max_bytes, std::chrono::microseconds cork_delay = {}) {
+            asio::post(strand_, make_pooled_handler([this, self = keep_alive(), max_messages, max_bytes, cork_delay]() {
+                max_batch_messages_ = std::max<size_t>(1, max_messages);
+                max_batch_bytes_ = max_bytes;
+                cork_delay_ = cork_delay;
+            }));
+        }
+
+        // Relative share of each lane, indexed by priority, when more than one has messages waiting.
+        // Every lane gets at least weight 1, so none can be starved.
+        void set_lane_weights(const std::array<uint32_t, PRIORITY_LANES>& weights) {
+            asio::post(strand_, make_pooled_handler([this, self = keep_alive(), weights]() {
+                for (size_t i = 0; i < PRIORITY_LANES; i++)
+                    lane_weights_[i] = std::max<uint32_t>(1, weights[i]);
+            }));
+        }
+
+        // Safe to call from any thread; each counter is read on its own, so they may be a few messages apart.
+        connection_stats get_stats() const {
+            connection_stats stats {
+                write_count_.load(std::memory_order_relaxed),
+                written_messages_.load(std::memory_order_relaxed),
+                written_bytes_.load(std::memory_order_relaxed),
+                received_messages_.load(std::memory_order_relaxed),
+                received_bytes_.load(std::memory_order_relaxed),
+                outgoing_depth_.load(std::memory_order_relaxed),
+                dropped_messages_.load(std::memory_order_relaxed),
+                dropped_bytes_.load(std::memory_order_relaxed)
+            };
+            for (size_t i = 0; i < PRIORITY_LANES; i++) {
+                stats.lanes[i].messages_out = lane_counters_[i].messages_out.load(std::memory_order_relaxed);
+                stats.lanes[i].bytes_out = lane_counters_[i].bytes_out.load(std::memory_order_relaxed);
+                stats.lanes[i].queue_depth = lane_counters_[i].queue_depth.load(std::memory_order_relaxed);
+            }
+            return stats;
+        }
+
+        // A peer that sends a message body larger than max_bytes, compressed or once expanded, is disconnected.
+        // Call before the handshake starts.
+        void set_max_message_size(size_t max_bytes) {
+            max_message_size_ = max_bytes;
+        }
+
+        // Bounds the outgoing queue, see outgoing_limits. Call before the handshake starts.
+        void set_outgoing_limits(const outgoing_limits& limits) {
+            limits_ = limits;
+        }
+
+        // True while the outgoing queue is above its high watermark; senders can hold back non-essential traffic.
+        bool would_block() const {
+            return congested_.load(std::memory_order_relaxed);
+        }
+
+        // Completed writes record their latency here. The server hands every connection of an io_context
+        // the same histogram, which only that context's thread writes to. Call before the handshake starts.
+        void set_write_latency_histogram(latency_histogram* histogram) {
+            write_latency_ = histogram;
+        }
+
+        // Server side: keeps up to max_messages of what was sent and not yet acknowledged, plus whatever was still
+        // queued when the connection closed, for a reconnecting client to resume the session with. 0 turns it off.
+        // Call before the handshake starts.
+        void set_replay_limit(size_t max_messages) {
+            replay_limit_ = max_messages;
+            if (max_messages > 0)
+                session_.capabilities |= CAP_RESUME;
+            else
+                session_.capabilities &= ~CAP_RESUME;
+        }
+
+        // Server side: whether the session can be resumed once the connection has closed.
+        bool is_resumable() const {
+            return replay_limit_ > 0 && validated_ && (peer_capabilities_ & CAP_RESUME);
+        }
+
+        // Server side: whether what is sent still goes somewhere, because the connection is open or because it is
+        // parked and keeps what is sent for a resuming client.
+        bool is_reachable() const {
+            return is_connected() || is_resumable();
+        }
+
+        // Server side, once closed and only from the thread running update(): after window, queues another
+        // control_frame::closed notice, which has update() drop the session for good unless a reconnect has taken
+        // it over by then. False if the session was parked already.
+        bool park(std::chrono::steady_clock::duration window) {
+            if (parked_)
+                return false;
+            parked_ = true;
+            asio::post(strand_, make_pooled_handler([this, self = keep_alive(), window]() {
+                park_timer_.expires_after(window);
+                park_timer_.async_wait(make_pooled_handler([this, self = keep_alive()](std::error_code ec) {
+                    if (!ec)
+                        queue_closed_notice();
+                }));
+            }));
+            return true;
+        }
+
+        // Server side, on this connection's strand while its handshake completes: continues the session of
+        // connection old as connection id, if old's replay buffer still holds everything after the first received
+        // messages, which is what a client that has received that many needs. Those messages go out first, in their
+        // original order, then whatever old still had queued, then what is sent to this connection. An old
+        // connection that is still open, most likely half-open after its client moved networks, is closed.
+        // False if old can't be taken over; nothing changes then.
+        bool take_over(connection& old, uint32_t id, uint64_t received) {
+            {
+                std::scoped_lock lock(old.replay_mtx_);
+                if (old.taken_over_ || received < old.replay_base_ || received > old.replay_base_ + old.replay_.size())
+                    return false;
+                size_t skipped = size_t(received - old.replay_base_);
+                for (auto it = old.replay_.rbegin(); it != old.replay_.rend() - skipped; ++it) {
+                    lane_of(*it).push_front(*it);
+                    queued_messages_++;
+                    outgoing_bytes_ += frame_size(*it);
+                }
+                old.successor_ = this->weak_from_this();
+                old.taken_over_ = true;
+            }
+            id_ = id;
+            {
+                // send_unreliable() and the server's UDP thread read these off the strand.
+                std::scoped_lock lock(udp_mtx_);
+                session_.id = id;
+                session_.token = old.session_.token;
+            }
+            session_.resumed = 1;
+            // Broadcasts reach this connection as soon as the caller has handed it the slot.
+            validated_ = true;
+            replay_base_ = acked_through_ = received;
+            // Datagrams carry on where old's left off, or the client would take them for stale ones.
+            udp_sequence_.store(old.udp_sequence_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            awaiting_predecessor_ = true;
+            queue_changed();
+            // Runs after every send that reached old before the caller handed its slot over; close() passes
+            // whatever old still had queued on, and this connection then goes on with its own sends.
+            asio::post(old.strand_, make_pooled_handler([&old, self = old.keep_alive(), successor = keep_alive()]() {
+                old.park_timer_.cancel();
+                old.close();
+                asio::post(successor->strand_, make_pooled_handler([successor]() {
+                    successor->release_held();
+                }));
+            }));
+            return true;
+        }
+
+        // Client side: the session to resume on the next connection, and how many of its messages have arrived.
+        // Only valid once the connection has closed.
+        std::pair<uint64_t, uint64_t> get_resume_point() const {
+            if (!session_received_ || !(peer_capabilities_ & CAP_RESUME))
+                return { 0, 0 };
+            return { session_.token, resume_base_ + received_messages_.load(std::memory_order_relaxed) };
+        }
+
+        // Client side: asks the server to resume the session token, of which received messages have arrived.
+        // Call before connect_to_server().
+        void set_resume_point(uint64_t token, uint64_t received) {
+            hello_.resume_token = token;
+            hello_.received = received;
+            resume_base_ = received;
+        }
+
+    private:
+        void enqueue_outgoing(outgoing_message<T>&& item) {
+            // A full drop_newest queue can turn the message away without a trip through the strand.
+            if (limits_.policy == overflow_policy::drop_newest && limits_.max_messages > 0 &&
+                outgoing_depth_.load(std::memory_order_relaxed) >= limits_.max_messages) {
+                count_drop(item);
+                return;
+            }
+
+            asio::post(strand_,
+                make_pooled_handler([this, self = keep_alive(), item = std::move(item)]() mutable {
+                    queue_outgoing(std::move(item));
+            }));
+        }
+
+        // Strand side of enqueue_outgoing(). forwarded is set for what the connection this one took over from
+        // passes on; until the last of it is in, everything else is held back.
+        void queue_outgoing(outgoing_message<T>&& item, bool forwarded = false) {
+            if (closed_) {
+                if (is_resumable())
+                    keep_for_replay(item);
+                return;
+            }
+            if (awaiting_predecessor_ && !forwarded) {
+                held_.push_back(std::move(item));
+                return;
+            }
+            if (!admit_outgoing(item))
+                return;
+            outgoing_bytes_ += frame_size(item);
+            lane_of(item).push_back(std::move(item));
+            queued_messages_++;
+            // drop_oldest, or coalesce that found nothing to replace.
+            while (over_limits(0, 0) && queued_messages_ > 0) {
+                auto& lane = *std::find_if(lanes_.rbegin(), lanes_.rend(), [](const auto& l) { return !l.empty(); });
+                count_drop(lane.front());
+                outgoing_bytes_ -= frame_size(lane.front());
+                lane.pop_front();
+                queued_messages_--;
+            }
+            queue_changed();
+            start_write();
+        }
+
+        // Control frames always take the high lane.
+        auto& lane_of(const outgoing_message<T>& item) {
+            bool control = item.get().header.size & CONTROL_FLAG;
+            return lanes_[control ? size_t(priority::high) : size_t(item.lane)];
+        }
+
+        static size_t frame_size(const outgoing_message<T>& item) {
+            return sizeof(message_header<T>) + item.get().body.size();
+        }
+
+        // Whether the queue would exceed its limits with extra_messages more messages of extra_bytes in total.
+        bool over_limits(size_t extra_messages, size_t extra_bytes) const {
+            size_t messages = queued_messages_ + in_flight_.size() + extra_messages;
+            return (limits_.max_messages > 0 && messages > limits_.max_messages) ||
+                   (limits_.max_bytes > 0 && outgoing_bytes_ + extra_bytes > limits_.max_bytes);
+        }
+
+        // Applies the overflow policy to a message about to be queued; false if it must not be queued.
+        bool admit_outgoing(outgoing_message<T>& item) {
+            if (!over_limits(1, frame_size(item)))
+                return true;
+
+            switch (limits_.policy) {
+                case overflow_policy::drop_newest:
+                    count_drop(item);
+                    return false;
+                case overflow_policy::disconnect:
+                    log_warn("{}: Outgoing queue over its limits, disconnecting.", id_);
+                    count_drop(item);
+                    close();
+                    return false;
+                case overflow_policy::coalesce:
+                    return !coalesce_outgoing(item);
+                default:
+                    return true;
+            }
+        }
+
+        // Latest-wins: swaps item into the place of the newest queued message with the same id.
+        bool coalesce_outgoing(outgoing_message<T>& item) {
+            const message_header<T>& header = item.get().header;
+            // Control frames all share the default id; they are never merged with anything.
+            if (header.size & CONTROL_FLAG)
+                return false;
+            auto& lane = lane_of(item);
+            for (auto it = lane.rbegin(); it != lane.rend(); ++it) {
+                const message_header<T>& queued = it->get().header;
+                if (queued.id != header.id || (queued.size & CONTROL_FLAG))
+                    continue;
+                count_drop(*it);
+                outgoing_bytes_ = outgoing_bytes_ - frame_size(*it) + frame_size(item);
+                *it = std::move(item);
+                return true;
+            }
+            return false;
+        }
+
+        void count_drop(const outgoing_message<T>& item) {
+            dropped_messages_.fetch_add(1, std::memory_order_relaxed);
+            dropped_bytes_.fetch_add(frame_size(item), std::memory_order_relaxed);
+        }
+
+        // Publishes the queue depth and tells the server when the queue crosses its watermarks.
+        void queue_changed() {
+            outgoing_depth_.store(queued_messages_ + in_flight_.size(), std::memory_order_relaxed);
+            for (size_t i = 0; i < PRIORITY_LANES; i++)
+                lane_counters_[i].queue_depth.store(lanes_[i].size(), std::memory_order_relaxed);
+            if (limits_.high_watermark == 0)
+                return;
+            bool congested = congested_.load(std::memory_order_relaxed);
+            if (!congested && outgoing_bytes_ >= limits_.high_watermark)
+                notify_congestion(true);
+            else if (congested && outgoing_bytes_ < limits_.high_watermark / 2)
+                notify_congestion(false);
+        }
+
+        void notify_congestion(bool congested) {
+            congested_.store(congested, std::memory_order_relaxed);
+            // Posted: this runs in the middle of queueing or of a write completion.
+            if (!congested) {
+                for (auto& waiter: send_waiters_)
+                    waiter.post({});
+                send_waiters_.clear();
+            }
+            if (owner_type_ == owner::server)
+                queue_notice(congested ? control_frame::congested : control_frame::drained);
+        }
+
+        void start_write() {
+            // Nothing but the handshake goes out until it is done.
+            if (writing_ || !validated_ || (queued_messages_ == 0 && handshake_prefix_.size() == 0))
+                return;
+
+            bool batch_full = queued_messages_ >= max_batch_messages_ || outgoing_bytes_ >= max_batch_bytes_;
+            if (cork_delay_.count() > 0 && !batch_full && handshake_prefix_.size() == 0) {
+                if (!corked_) {
+                    corked_ = true;
+                    cork_timer_.expires_after(cork_delay_);
+                    cork_timer_.async_wait(make_pooled_handler([this, self = keep_alive()](std::error_code ec) {
+                        corked_ = false;
+                        if (!ec && !writing_ && queued_messages_ > 0)
+                            write_messages();
+                    }));
+                }
+                return;
+            }
+
+            write_messages();
+        }
+
+        // async
+        // Reads whatever the socket has into the receive buffer and hands up every complete frame in it.
+        void read_messages() {
+            if (recv_buffer_.empty())
+                recv_buffer_.resize(RECV_BUFFER_SIZE);
+            // Move the partial frame left over by the last parse to the front to make room.
+            if (recv_begin_ > 0) {
+                std::memmove(recv_buffer_.data(), recv_buffer_.data() + recv_begin_, recv_end_ - recv_begin_);
+                recv_end_ -= recv_begin_;
+                recv_begin_ = 0;
+            }
+
+            socket_.async_read_some(asio::buffer(recv_buffer_.data() + recv_end_, recv_buffer_.size() - recv_end_),
+                asio::bind_executor(strand_, make_pooled_handler([this, self = keep_alive()](std::error_code ec, std::size_t length) {
                     if (!ec) {
-                        add_to_incoming_messages_queue();
+                        recv_end_ += length;
+                        received_bytes_.fetch_add(length, std::memory_order_relaxed);
+                        recv_time_ = std::chrono::steady_clock::now();
+                        last_received_.store(recv_time_.time_since_epoch().count(), std::memory_order_relaxed);
+                        parse_frames();
+                        continue_reading();
                     } else {
-                        std::cout << "[WARN] " << id_ << ": Read body failed.\n";
-                        std::cout << "[WARN] " << id_ << ": " << ec.message() << "\n";
-                        socket_.close();
+                        // A read aborted by close() needs no warning; whoever closed the socket said why.
+                        if (socket_.is_open())
+                            log_warn("{}: Read failed: {}", id_, ec);
+                        close();
                     }
-            });
+            })));
+        }
+
+        // After a parse: reads on, unless what was parsed is still waiting for room in a queue.
+        void continue_reading() {
+            if (stalled_)
+                wait_for_incoming_room();
+            // Nobody is draining receive(); leave the rest in the socket until someone does.
+            else if (direct_receive_ && inbox_.size() >= DIRECT_INBOX_LIMIT)
+                read_paused_ = true;
+            else
+                read_messages();
+        }
+
+        // Retries the message that found the incoming queue full, then parses on from where it stopped.
+        // Meanwhile nothing is read, so the peer is held back by TCP flow control rather than disconnected.
+        void wait_for_incoming_room() {
+            stall_timer_.expires_after(NOTICE_RETRY_DELAY);
+            stall_timer_.async_wait(make_pooled_handler([this, self = keep_alive()](std::error_code ec) {
+                if (closed_ || !stalled_)
+                    return;
+                if (!push_incoming(*stalled_)) {
+                    wait_for_incoming_room();
+                    return;
+                }
+                stalled_.reset();
+                parse_frames();
+                if (!closed_)
+                    continue_reading();
+            }));
+        }
+
+        void resume_reading() {
+            if (read_paused_ && inbox_.size() < DIRECT_INBOX_LIMIT / 2 && !closed_) {
+                read_paused_ = false;
+                read_messages();
+            }
+        }
+
+        void parse_frames() {
+            // The client's answer to the challenge precedes its first message.
+            if (owner_type_ == owner::server && !validated_) {
+                if (recv_end_ - recv_begin_ < sizeof(client_hello))
+                    return;
+                std::memcpy(&hello_, recv_buffer_.data() + recv_begin_, sizeof(client_hello));
+                recv_begin_ += sizeof(client_hello);
+                if (!validate_hello())
+                    return;
+            }
+
+            // The server's session block precedes its first message.
+            if (owner_type_ == owner::client && !session_received_) {
+                if (recv_end_ - recv_begin_ < sizeof(session_info))
+                    return;
+                std::memcpy(&session_, recv_buffer_.data() + recv_begin_, sizeof(session_info));
+                recv_begin_ += sizeof(session_info);
+                id_ = session_.id;
+                peer_capabilities_ = session_.capabilities;
+                session_received_ = true;
+                // A session the server no longer had starts counting afresh.
+                if (!session_.resumed)
+                    resume_base_ = 0;
+            }
+
+            // Size of the frame the loop stopped short of, if it did.
+            size_t pending_frame = 0;
+            while (recv_end_ - recv_begin_ >= sizeof(message_header<T>)) {
+                message_header<T> header;
+                std::memcpy(&header, recv_buffer_.data() + recv_begin_, sizeof(message_header<T>));
+                if (header.size & CONTROL_FLAG) {
+                    recv_begin_ += sizeof(message_header<T>);
+                    on_control_frame(control_frame(header.size & ~CONTROL_FLAG));
+                    continue;
+                }
+                bool compressed = header.size & COMPRESSED_FLAG;
+                uint32_t body_size = header.size & ~COMPRESSED_FLAG;
+                size_t frame_size = sizeof(message_header<T>) + body_size;
+                // Checked before the buffer grows for it, so a forged header can't make it allocate.
+                if (body_size > max_message_size_) {
+                    log_warn("{}: Disconnecting: a message of {} bytes exceeds the limit of {}, ID {}.", id_, body_size, max_message_size_, header.id);
+                    close();
+                    return;
+                }
+                if (recv_end_ - recv_begin_ < frame_size) {
+                    // Make sure the rest of an oversized frame will fit once the buffer is compacted.
+                    if (frame_size > recv_buffer_.size())
+                        recv_buffer_.resize(frame_size);
+                    pending_frame = frame_size;
+                    break;
+                }
+
+                // Assert if msg size is gonna exceed MAX_MSG_SIZE. If so, log it (for now).
+                if (body_size > MAX_MSG_SIZE) {
+                    log_warn("{}: A message exceeded MAX_MSG_SIZE = {}: {} bytes, ID {}.", id_, MAX_MSG_SIZE, body_size, header.id);
+                }
+
+                const uint8_t* body = recv_buffer_.data() + recv_begin_ + sizeof(message_header<T>);
+                current_incoming_message_.header = header;
+                if (!compressed) {
+                    current_incoming_message_.body.assign(body, body + body_size);
+                } else if (!decompress_body(body, body_size, current_incoming_message_, max_message_size_)) {
+                    log_warn("{}: Malformed compressed message.", id_);
+                    close();
+                    return;
+                }
+                recv_begin_ += frame_size;
+                add_to_incoming_messages_queue();
+                // The rest stays in the buffer until the stalled message is through.
+                if (closed_ || stalled_)
+                    return;
+            }
+
+            if (recv_begin_ == recv_end_)
+                recv_begin_ = recv_end_ = 0;
+            // A buffer grown for an oversized frame goes back to its usual size once that frame is through.
+            if (recv_buffer_.size() > RECV_BUFFER_SIZE && pending_frame <= RECV_BUFFER_SIZE)
+                shrink_recv_buffer();
+        }
+
+        void shrink_recv_buffer() {
+            size_t unparsed = recv_end_ - recv_begin_;
+            decltype(recv_buffer_) buffer(RECV_BUFFER_SIZE);
+            std::memcpy(buffer.data(), recv_buffer_.data() + recv_begin_, unparsed);
+            recv_buffer_.swap(buffer);
+            recv_begin_ = 0;
+            recv_end_ = unparsed;
         }
 
         // async
-        void write_header() {
-            asio::async_write(socket_, asio::buffer(&outgoing_messages_.front().header, sizeof(message_header<T>)),
-                [this](asio::error_code ec, std::size_t length) {
+        // Gathers header+body buffer pairs of the queued messages into a single write.
+        // The batch moves to in_flight_, so overflow policies can drop from the queue while it is being written.
+        // Lanes are drained by deficit round robin: each batch is one round, in which every waiting lane earns
+        // weight * LANE_QUANTUM bytes of credit and sends while it has credit left, highest priority first.
+        // A lane may overdraw by one message and pays it back in later rounds. Each lane in credit is guaranteed
+        // a slot in the batch, so a busy high lane can't crowd the others out.
+        void write_messages() {
+            write_buffers_.clear();
+            size_t batch_bytes = 0;
+            bool compress = compression_threshold_ > 0 && (peer_capabilities_ & CAP_COMPRESSION);
+            start_lane_round();
+            for (size_t i = 0; i < PRIORITY_LANES; i++) {
+                auto& lane = lanes_[i];
+                size_t reserved = 0;
+                for (size_t j = i + 1; j < PRIORITY_LANES; j++)
+                    reserved += !lanes_[j].empty() && lane_deficit_[j] > 0;
+
+                while (!lane.empty() && lane_deficit_[i] > 0) {
+                    auto& item = lane.front();
+                    if (compress)
+                        compress_outgoing(item);
+                    size_t size = frame_size(item);
+                    if (!in_flight_.empty() &&
+                        (in_flight_.size() + reserved >= max_batch_messages_ || batch_bytes + size > max_batch_bytes_))
+                        break;
+                    lane_deficit_[i] -= int64_t(size);
+                    in_flight_.push_back(std::move(item));
+                    keep_for_replay(in_flight_.back());
+                    lane.pop_front();
+                    queued_messages_--;
+                    batch_bytes += size;
+                }
+            }
+            // The last handshake block goes out in front of the first batch rather than in a write of its own.
+            size_t prefix_bytes = handshake_prefix_.size();
+            if (prefix_bytes > 0) {
+                write_buffers_.push_back(handshake_prefix_);
+                handshake_prefix_ = {};
+            }
+            for (const auto& item: in_flight_) {
+                const message<T>& msg = item.get();
+                write_buffers_.push_back(asio::buffer(&msg.header, sizeof(message_header<T>)));
+                if (!msg.body.empty())
+                    write_buffers_.push_back(asio::buffer(msg.body.data(), msg.body.size()));
+            }
+
+            writing_ = true;
+            write_started_ = std::chrono::steady_clock::now();
+            asio::async_write(socket_, std::span<const asio::const_buffer>(write_buffers_),
+                asio::bind_executor(strand_, make_pooled_handler([this, self = keep_alive(), prefix_bytes](asio::error_code ec, std::size_t length) {
+                    writing_ = false;
                     if (!ec) {
-                        if (outgoing_messages_.front().body.size() > 0) {
-                            write_body();
-                        } else {
-                            outgoing_messages_.pop_front();
-                            if (!outgoing_messages_.empty())
-                                write_header();
+                        length -= prefix_bytes;
+                        if (write_latency_)
+                            write_latency_->record(std::chrono::steady_clock::now() - write_started_);
+                        write_count_.fetch_add(1, std::memory_order_relaxed);
+                        written_messages_.fetch_add(in_flight_.size(), std::memory_order_relaxed);
+                        written_bytes_.fetch_add(length, std::memory_order_relaxed);
+
+                        outgoing_bytes_ -= length;
+                        for (const auto& item: in_flight_) {
+                            auto& counters = lane_counters_[size_t(item.lane)];
+                            counters.messages_out.fetch_add(1, std::memory_order_relaxed);
+                            counters.bytes_out.fetch_add(frame_size(item), std::memory_order_relaxed);
                         }
+                        in_flight_.clear();
+                        queue_changed();
+                        // Whatever queued up meanwhile has already waited a full write; don't cork it again.
+                        if (queued_messages_ > 0)
+                            write_messages();
                     } else {
-                        std::cout << "[WARN] " << id_ << ": Write header failed.\n";
-                        std::cout << "[WARN] " << id_ << ": " << ec.message() << "\n";
-                        socket_.close();
+                        if (socket_.is_open())
+                            log_warn("{}: Write failed: {}", id_, ec);
+                        close();
                     }
-            });
+            })));
         }
 
-        // async
-        void write_body() {
-            asio::async_write(socket_, asio::buffer(outgoing_messages_.front().body.data(), outgoing_messages_.front().body.size()),
-                [this](asio::error_code ec, std::size_t length) {
-                    if (!ec) {
-                        outgoing_messages_.pop_front();
-                        if (!outgoing_messages_.empty())
-                            write_header();
-                    } else {
-                        std::cout << "[WARN] " << id_ << ": Write body failed.\n";
-                        std::cout << "[WARN] " << id_ << ": " << ec.message() << "\n";
-                        socket_.close();
+        // Credits every waiting lane for one round, or for as many as it takes to bring one back into credit.
+        void start_lane_round() {
+            int64_t rounds = std::numeric_limits<int64_t>::max();
+            for (size_t i = 0; i < PRIORITY_LANES; i++) {
+                if (lanes_[i].empty())
+                    continue;
+                int64_t quantum = int64_t(lane_weights_[i] * LANE_QUANTUM);
+                rounds = std::min(rounds, lane_deficit_[i] > 0 ? 1 : -lane_deficit_[i] / quantum + 1);
+            }
+            for (size_t i = 0; i < PRIORITY_LANES; i++) {
+                int64_t quantum = int64_t(lane_weights_[i] * LANE_QUANTUM);
+                // An idle lane doesn't bank credit, and a busy one can't carry more than a round's worth forward.
+                lane_deficit_[i] = lanes_[i].empty() ? 0 : std::min(lane_deficit_[i] + rounds * quantum, 2 * quantum);
+            }
+        }
+
+        // Swaps a large enough queued message for its compressed form. A shared message is compressed once for all
+        // the connections it goes to, and they share the result as well.
+        void compress_outgoing(outgoing_message<T>& item) {
+            const message<T>& msg = item.get();
+            if (msg.body.size() < compression_threshold_ || (msg.header.size & COMPRESSED_FLAG))
+                return;
+
+            if (item.shared) {
+                const shared_message<T>& shared_packed = compressed_form(item.shared);
+                if (shared_packed) {
+                    outgoing_bytes_ -= msg.body.size() - shared_packed->body.size();
+                    item.shared = shared_packed;
+                }
+                return;
+            }
+            message<T> packed;
+            if (!compress_message(msg, packed))
+                return;
+            outgoing_bytes_ -= msg.body.size() - packed.body.size();
+            item.msg = std::move(packed);
+        }
+
+        // Handlers hold this so that a connection outlives every operation still pending on it, even once the
+        // server or client_interface has dropped it.
+        std::shared_ptr<connection> keep_alive() {
+            return this->weak_from_this().lock();
+        }
+
+        // Pings are answered right away; any frame at all already counted as activity when it was read.
+        void on_control_frame(control_frame kind) {
+            if (kind == control_frame::ping) {
+                send_control(control_frame::pong);
+            } else if (kind == control_frame::ack && !closed_) {
+                // Once taken over, the replay buffer is left as it was; the new connection has its own.
+                std::scoped_lock lock(replay_mtx_);
+                acked_through_ += ACK_STRIDE;
+                while (!taken_over_ && replay_base_ < acked_through_ && !replay_.empty()) {
+                    replay_.pop_front();
+                    replay_base_++;
+                }
+            }
+        }
+
+        // Server side: keeps a message that is written, or sent once closed, for a resuming client, sharing rather
+        // than copying it. The oldest message goes once the buffer is full; a client that missed it can't resume.
+        // Once the session has been taken over, the message is passed on to the connection that took it instead.
+        void keep_for_replay(outgoing_message<T>& item) {
+            if (replay_limit_ == 0 || !(peer_capabilities_ & CAP_RESUME) || (item.get().header.size & CONTROL_FLAG))
+                return;
+            if (!item.shared)
+                item.shared = make_shared_message(std::move(item.msg));
+            std::shared_ptr<connection> successor;
+            {
+                std::scoped_lock lock(replay_mtx_);
+                if (!taken_over_) {
+                    replay_.push_back({ {}, item.shared, item.lane });
+                    if (replay_.size() > replay_limit_) {
+                        replay_.pop_front();
+                        replay_base_++;
                     }
-            });
+                    return;
+                }
+                successor = successor_.lock();
+            }
+            if (successor)
+                asio::post(successor->strand_, make_pooled_handler([successor, item = outgoing_message<T> { {}, item.shared, item.lane }]() mutable {
+                    successor->queue_outgoing(std::move(item), true);
+                }));
         }
 
-        void add_to_incoming_messages_queue() {
+        // Server side: the connection this one took over from has passed on all it had; what was sent to this one
+        // meanwhile goes out behind that.
+        void release_held() {
+            awaiting_predecessor_ = false;
+            auto held = std::move(held_);
+            held_.clear();
+            for (auto& item: held)
+                queue_outgoing(std::move(item));
+        }
+
+        void queue_closed_notice() {
+            queue_notice(control_frame::closed);
+        }
+
+        // Hands update() a notice about this connection, behind any that are still waiting for room.
+        void queue_notice(control_frame kind) {
+            deferred_notices_.push_back(kind);
+            if (deferred_notices_.size() == 1)
+                flush_notices();
+        }
+
+        // Notices can't be dropped, or update() would miss a disconnect; nor waited for on an I/O thread, which
+        // would stall every connection on its io_context. So those that find the queue full are retried later.
+        void flush_notices() {
+            while (!deferred_notices_.empty()) {
+                message<T> notice;
+                notice.header.size = CONTROL_FLAG | uint32_t(deferred_notices_.front());
+                owned_message<T> item { this->shared_from_this(), std::move(notice), std::chrono::steady_clock::now() };
+                if (!incoming_messages_.try_push_back(std::move(item))) {
+                    notice_timer_.expires_after(NOTICE_RETRY_DELAY);
+                    notice_timer_.async_wait(make_pooled_handler([this, self = keep_alive()](std::error_code ec) {
+                        flush_notices();
+                    }));
+                    return;
+                }
+                deferred_notices_.pop_front();
+            }
+        }
+
+        void send_control(control_frame kind) {
+            message<T> msg;
+            msg.header.size = CONTROL_FLAG | uint32_t(kind);
+            send(std::move(msg), priority::high);
+        }
+
+        // Closes the socket once. A server connection then queues a control_frame::closed notice behind its
+        // last message, so update() drops it and calls on_client_disconnect without waiting for a send to fail.
+        void close() {
+            if (closed_)
+                return;
+            closed_ = true;
+            socket_.close();
+            // Nothing queued can be sent any more; the batch being written goes when its write fails.
+            // A resumable session keeps it for the next connection.
+            for (auto& lane: lanes_) {
+                for (auto& item: lane) {
+                    outgoing_bytes_ -= frame_size(item);
+                    keep_for_replay(item);
+                }
+                lane.clear();
+            }
+            queued_messages_ = 0;
+            for (auto& item: held_)
+                keep_for_replay(item);
+            held_.clear();
+            stalled_.reset();
+            outgoing_depth_.store(in_flight_.size(), std::memory_order_relaxed);
+            // A pending receive() means nothing is buffered; whatever is buffered is still handed out first.
+            receiver_.post(asio::error::eof, {});
+            for (auto& waiter: send_waiters_)
+                waiter.post(asio::error::not_connected);
+            send_waiters_.clear();
             if (owner_type_ == owner::server)
-                incoming_messages_.push_back({ this->shared_from_this(), current_incoming_message_ });
-            else
-                incoming_messages_.push_back({ nullptr, current_incoming_message_ });
+                queue_closed_notice();
+        }
+
+        // Writes are already coalesced by write_messages(); Nagle would only hold the next batch back until the
+        // peer's delayed ACK, which shows up as tens of milliseconds on one-way streams such as broadcasts.
+        void disable_nagle() {
+            asio::error_code ec;
+            socket_.set_option(asio::ip::tcp::no_delay(true), ec);
+        }
 
-            read_header();
+        void add_to_incoming_messages_queue() {
+            uint64_t received = received_messages_.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (owner_type_ == owner::client && (peer_capabilities_ & CAP_RESUME) && received % ACK_STRIDE == 0)
+                send_control(control_frame::ack);
+            if (direct_receive_) {
+                message<T> msg = std::move(current_incoming_message_);
+                current_incoming_message_.clear();
+                // The waiting coroutine may run to its next receive() before this returns.
+                if (receiver_)
+                    receiver_.dispatch({}, std::move(msg));
+                else
+                    inbox_.push_back(std::move(msg));
+                return;
+            }
+            // A handler that didn't move the body leaves its buffer for the next message to reuse.
+            if (server_ && server_->dispatch_inline(*this, current_incoming_message_)) {
+                current_incoming_message_.clear();
+                return;
+            }
+            // The message is moved into the queue; its body buffer now belongs to the consumer.
+            owned_message<T> item { nullptr, std::move(current_incoming_message_), recv_time_ };
+            current_incoming_message_.clear();
+            // Waiting for room would stall every connection on this io_context, so reading stops instead and
+            // continue_reading() retries the message from a timer.
+            if (!push_incoming(item))
+                stalled_ = std::move(item);
+        }
+
+        // Moves item into the incoming queue, with this connection as its remote on the server side. Left as it was
+        // if the queue is full: without a remote, so that a stalled message doesn't keep its connection alive
+        // when the server stops with the retry still pending.
+        bool push_incoming(owned_message<T>& item) {
+            if (owner_type_ == owner::server)
+                item.remote = this->shared_from_this();
+            if (incoming_messages_.try_push_back(std::move(item)))
+                return true;
+            item.remote.reset();
+            return false;
         }
 
         uint64_t encode(uint64_t bin) {
@@ -182,58 +1054,179 @@ namespace blcl::net {
         }
 
         // async
+        // The server writes its challenge. Messages queued meanwhile wait until the client has answered it.
         void write_validation() {
+            writing_ = true;
             asio::async_write(socket_, asio::buffer(&checksum_out_, sizeof(uint64_t)),
-                [this](std::error_code ec, std::size_t length) {
+                asio::bind_executor(strand_, make_pooled_handler([this, self = keep_alive()](std::error_code ec, std::size_t length) {
+                    writing_ = false;
                     if (!ec) {
-                        if (owner_type_ == owner::client)
-                            read_header();
+                        start_write();
                     } else {
-                        socket_.close();
+                        close();
                     }
-            });
+            })));
+        }
+
+        // Checks the client's answer, which parse_frames() has just taken off the receive buffer. On success the
+        // session block is written in front of the first batch of queued messages.
+        bool validate_hello() {
+            if (hello_.checksum != expected_checksum_) {
+                log_warn("{}: Client disconnected: challenge-response failed.", id_);
+                asio::error_code ec;
+                auto endpoint = socket_.remote_endpoint(ec);
+                if (!ec)
+                    server_->handshake_failed(endpoint.address());
+                close();
+                return false;
+            }
+
+            log_info("{}: Challenge-response passed.", id_);
+            peer_capabilities_ = hello_.capabilities;
+            heartbeat_peer_.store(peer_capabilities_ & CAP_HEARTBEAT, std::memory_order_relaxed);
+            if (hello_.resume_token != 0 && replay_limit_ > 0 && (peer_capabilities_ & CAP_RESUME))
+                server_->resume_session(this->shared_from_this(), hello_.resume_token, hello_.received);
+            validated_ = true;
+            server_->client_validated(this->shared_from_this());
+            handshake_prefix_ = asio::buffer(&session_, sizeof(session_info));
+            start_write();
+            return true;
         }
 
         // async
-        void read_validation(blcl::net::server_interface<T>* server = nullptr) {
+        // The client reads the challenge and answers it in front of whatever it queued while connecting, so its first
+        // message doesn't wait for a write of its own.
+        void read_validation() {
             asio::async_read(socket_, asio::buffer(&checksum_in_, sizeof(uint64_t)),
-                [this, server](std::error_code ec, std::size_t length) {
+                asio::bind_executor(strand_, make_pooled_handler([this, self = keep_alive()](std::error_code ec, std::size_t length) {
                     if (!ec) {
-                        if (owner_type_ == owner::server) {
-                            if (checksum_in_ == expected_checksum_) {
-                                std::cout << "[INFO] Challenge-response passed." << std::endl;
-                                validated_ = true;
-                                server->on_client_validated(this->shared_from_this());
-
-                                read_header();
-                            } else {
-                                std::cout << "[WARN] Client disconnected: challenge-reponse failed." << std::endl;
-                                socket_.close();
-                            }
-                        } else {
-                            checksum_out_ = encode(checksum_in_);
-                            write_validation();
-                        }
+                        hello_.checksum = encode(checksum_in_);
+                        hello_.capabilities = LOCAL_CAPABILITIES;
+                        handshake_prefix_ = asio::buffer(&hello_, sizeof(client_hello));
+                        validated_ = true;
+                        read_messages();
+                        start_write();
                     } else {
-                        std::cout << "[WARN] Client disconnected on reading challenge-response." << std::endl;
-                        socket_.close();
+                        log_warn("{}: Client disconnected on reading challenge-response: {}", id_, ec);
+                        close();
                     }
-            });
+            })));
         }
 
     protected:
-        asio::ip::tcp::socket socket_;
         asio::io_context& asio_context_;
-        tsqueue<message<T>> outgoing_messages_;
-        tsqueue<owned_message<T>>& incoming_messages_;
+        // Serializes every handler of this connection, whichever pool thread runs it.
+        // Its executor allocates from buffer_pool so posting to it from another thread doesn't hit the heap.
+        asio::strand<asio::io_context::basic_executor_type<pool_allocator<void>, 0>> strand_;
+        asio::ip::tcp::socket socket_;
+        // Only touched on strand_. Messages waiting for a write, one queue per priority.
+        std::array<std::deque<outgoing_message<T>, pool_allocator<outgoing_message<T>>>, PRIORITY_LANES> lanes_;
+        size_t queued_messages_ = 0;
+        // Bytes of credit per round for weight 1, about one MTU.
+        static constexpr size_t LANE_QUANTUM = 1500;
+        std::array<uint32_t, PRIORITY_LANES> lane_weights_ { 8, 4, 1 };
+        std::array<int64_t, PRIORITY_LANES> lane_deficit_ {};
+        struct lane_counters {
+            std::atomic<uint64_t> messages_out { 0 };
+            std::atomic<uint64_t> bytes_out { 0 };
+            std::atomic<size_t> queue_depth { 0 };
+        };
+        std::array<lane_counters, PRIORITY_LANES> lane_counters_ {};
+        // The batch being written; the gathered buffers point into it until the write completes.
+        std::vector<outgoing_message<T>> in_flight_;
+        // Frames in lanes_ and in_flight_.
+        size_t outgoing_bytes_ = 0;
+        std::vector<asio::const_buffer> write_buffers_;
+        outgoing_limits limits_;
+        std::atomic<bool> congested_ { false };
+        // Set by close(); later sends are discarded, unless a parked session keeps them for replay.
+        bool closed_ = false;
+        std::atomic<uint64_t> dropped_messages_ { 0 };
+        std::atomic<uint64_t> dropped_bytes_ { 0 };
+        bool writing_ = false;
+        size_t max_batch_messages_ = 32;
+        size_t max_batch_bytes_ = 64 * 1024;
+        std::chrono::microseconds cork_delay_ {};
+        asio::steady_timer cork_timer_;
+        bool corked_ = false;
+        // Only touched on strand_. Notices for update() that found the incoming queue full, oldest first.
+        static constexpr std::chrono::milliseconds NOTICE_RETRY_DELAY { 1 };
+        std::deque<control_frame> deferred_notices_;
+        asio::steady_timer notice_timer_;
+        // Only touched on strand_. A received message that found the incoming queue full; reading waits for it.
+        std::optional<owned_message<T>> stalled_;
+        asio::steady_timer stall_timer_;
+        std::atomic<uint64_t> write_count_ { 0 };
+        std::atomic<uint64_t> written_messages_ { 0 };
+        std::atomic<uint64_t> written_bytes_ { 0 };
+        std::atomic<uint64_t> received_messages_ { 0 };
+        std::atomic<uint64_t> received_bytes_ { 0 };
+        std::atomic<size_t> outgoing_depth_ { 0 };
+        latency_histogram* write_latency_ = nullptr;
+        std::chrono::steady_clock::time_point write_started_;
+        mpsc_queue<owned_message<T>>& incoming_messages_;
         message<T> current_incoming_message_;
+        // Only touched on strand_. With direct_receive_, messages go to the pending receive() or wait in inbox_.
+        static constexpr size_t DIRECT_INBOX_LIMIT = 256;
+        bool direct_receive_ = false;
+        completion_slot<message<T>> receiver_;
+        std::deque<message<T>, pool_allocator<message<T>>> inbox_;
+        bool read_paused_ = false;
+        // async_send() calls waiting for the queue to drain below the high watermark.
+        std::vector<completion_slot<>> send_waiters_;
+        // Receive buffer filled in large chunks; [recv_begin_, recv_end_) is not parsed yet.
+        static constexpr size_t RECV_BUFFER_SIZE = 8 * 1024;
+        size_t max_message_size_ = DEFAULT_MAX_MESSAGE_SIZE;
+        std::vector<uint8_t, pool_allocator<uint8_t>> recv_buffer_;
+        size_t recv_begin_ = 0;
+        size_t recv_end_ = 0;
+        // When the read that is being parsed completed; stamped on every message it yields.
+        std::chrono::steady_clock::time_point recv_time_;
+        // recv_time_ of the last read, in steady_clock ticks, for check_liveness() on other threads.
+        std::atomic<int64_t> last_received_ { 0 };
         owner owner_type_ = owner::server;
+        // Server side: the server that accepted this connection, for messages it handles inline.
+        server_interface<T>* server_ = nullptr;
         uint32_t id_ = 0;
         bool validated_ = false;
 
         uint64_t checksum_out_ = 0;
         uint64_t checksum_in_ = 0;
         uint64_t expected_checksum_ = 0;
+        client_hello hello_;
+        // Server side: messages sent or queued but not acknowledged, the first of them being message number
+        // replay_base_ of the session. Guarded by replay_mtx_, since a resuming connection reads them from its own strand.
+        size_t replay_limit_ = 0;
+        std::deque<outgoing_message<T>, pool_allocator<outgoing_message<T>>> replay_;
+        uint64_t replay_base_ = 0;
+        uint64_t acked_through_ = 0;
+        asio::steady_timer park_timer_;
+        std::mutex replay_mtx_;
+        std::weak_ptr<connection> successor_;
+        bool taken_over_ = false;
+        // Only touched by the thread running update().
+        bool parked_ = false;
+        // Only touched on strand_. Set while the connection this one took over still has messages to pass on;
+        // sends to this one wait in held_ until then.
+        bool awaiting_predecessor_ = false;
+        std::deque<outgoing_message<T>, pool_allocator<outgoing_message<T>>> held_;
+        // Client side: messages of the session received on earlier connections.
+        uint64_t resume_base_ = 0;
+        // Handshake block that the next write sends ahead of the queued messages.
+        asio::const_buffer handshake_prefix_;
+        size_t compression_threshold_ = 0;
+        uint32_t peer_capabilities_ = 0;
+        // Whether the peer advertised CAP_HEARTBEAT; read by check_liveness() on other threads.
+        std::atomic<bool> heartbeat_peer_ { false };
+
+        session_info session_;
+        bool session_received_ = false;
+        udp_channel<T>* udp_ = nullptr;
+        std::mutex udp_mtx_;
+        asio::ip::udp::endpoint udp_endpoint_;
+        bool udp_bound_ = false;
+        std::atomic<uint32_t> udp_sequence_ { 0 };
+        udp_sequence_filter<T> udp_filter_;
     };
 }
 
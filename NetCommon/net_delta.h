@@ -0,0 +1,281 @@
+#ifndef NETCLIENT_NET_DELTA_H
+#define NETCLIENT_NET_DELTA_H
+
+#include "net_common.h"
+#include "net_message.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace blcl::net {
+    // Describes a trivially copyable state struct as a row of 32-bit fields. Every field starts out raw
+    // (sent bit-exact when it changes); quantize() turns a run of float fields into fixed-point with the given step.
+    template <typename State>
+    class delta_schema {
+    public:
+        static_assert(std::is_trivially_copyable_v<State>, "Delta-encoded state must be trivially copyable.");
+        static_assert(sizeof(State) % sizeof(uint32_t) == 0 && sizeof(State) / sizeof(uint32_t) <= 32,
+                "Delta-encoded state must be made of at most 32 four-byte fields.");
+
+        static constexpr size_t FIELD_COUNT = sizeof(State) / sizeof(uint32_t);
+        using fields = std::array<uint32_t, FIELD_COUNT>;
+
+        // offset is the byte offset of the first float, e.g. offsetof(State, pos).
+        delta_schema& quantize(size_t offset, size_t count, float precision) {
+            for (size_t i = offset / sizeof(uint32_t); i < offset / sizeof(uint32_t) + count && i < FIELD_COUNT; i++)
+                precision_[i] = precision;
+            return *this;
+        }
+
+        // Maps a state to what goes on the wire: quantized fields become fixed-point integers, raw ones keep their bits.
+        fields to_fields(const State& state) const {
+            fields out;
+            std::memcpy(out.data(), &state, sizeof(State));
+            for (size_t i = 0; i < FIELD_COUNT; i++) {
+                if (precision_[i] == 0)
+                    continue;
+                float value;
+                std::memcpy(&value, &out[i], sizeof(float));
+                double q = std::nearbyint(double(value) / precision_[i]);
+                out[i] = uint32_t(int32_t(std::clamp(std::isnan(q) ? 0.0 : q, double(INT32_MIN), double(INT32_MAX))));
+            }
+            return out;
+        }
+
+        State from_fields(const fields& in) const {
+            fields raw = in;
+            for (size_t i = 0; i < FIELD_COUNT; i++) {
+                if (precision_[i] == 0)
+                    continue;
+                float value = float(double(int32_t(in[i])) * precision_[i]);
+                std::memcpy(&raw[i], &value, sizeof(float));
+            }
+            State state;
+            std::memcpy(&state, raw.data(), sizeof(State));
+            return state;
+        }
+
+        bool is_quantized(size_t field) const {
+            return precision_[field] != 0;
+        }
+
+    private:
+        std::array<float, FIELD_COUNT> precision_ {};
+    };
+
+    // Wire format shared by delta_encoder and delta_decoder, appended to the message body:
+    // uint16 sequence (low bits of a uint32 counter), varint (sequence - baseline) or 0 for a full snapshot, varint changed-field mask, then per set bit
+    // a zigzag varint difference for quantized fields or the 4 raw bytes for raw ones. A full snapshot is a delta
+    // against an all-zero state, so fields that are zero cost nothing.
+    namespace delta_detail {
+        constexpr size_t HISTORY = 64;
+
+        template <typename Body>
+        void put_varint(Body& body, uint32_t value) {
+            while (value >= 0x80) {
+                body.push_back(uint8_t(value | 0x80));
+                value >>= 7;
+            }
+            body.push_back(uint8_t(value));
+        }
+
+        inline bool get_varint(const uint8_t*& in, const uint8_t* end, uint32_t& value) {
+            value = 0;
+            for (int shift = 0; shift < 35 && in < end; shift += 7) {
+                uint8_t byte = *in++;
+                value |= uint32_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                    return true;
+            }
+            return false;
+        }
+
+        inline uint32_t zigzag(uint32_t diff) {
+            return (diff << 1) ^ uint32_t(int32_t(diff) >> 31);
+        }
+
+        inline uint32_t unzigzag(uint32_t value) {
+            return (value >> 1) ^ (0u - (value & 1));
+        }
+    }
+
+    // Server side of one delta stream, e.g. one entity as seen by one client. Deltas are taken against the newest
+    // state the client acknowledged; without a usable ack (none yet, too old, or after reset()) a full snapshot is sent.
+    template <typename State>
+    class delta_encoder {
+    public:
+        using schema_type = delta_schema<State>;
+
+        explicit delta_encoder(schema_type schema): schema_(schema) {
+
+        }
+
+        // Appends the encoded state to msg and returns its wire sequence, which the client acks once applied.
+        template <typename T>
+        uint16_t encode(const State& state, message<T>& msg) {
+            using namespace delta_detail;
+            auto current = schema_.to_fields(state);
+            uint32_t sequence = ++sequence_;
+
+            static const typename schema_type::fields zero {};
+            const auto* baseline = &zero;
+            uint32_t distance = 0;
+            if (acked_ != 0 && sequence - acked_ < HISTORY && history_[acked_ % HISTORY].sequence == acked_) {
+                baseline = &history_[acked_ % HISTORY].fields;
+                distance = sequence - acked_;
+            }
+
+            uint32_t mask = 0;
+            for (size_t i = 0; i < schema_type::FIELD_COUNT; i++)
+                if (current[i] != (*baseline)[i])
+                    mask |= uint32_t(1) << i;
+
+            size_t start = msg.body.size();
+            if (msg.body.capacity() < start + MAX_ENCODED_SIZE)
+                msg.body.reserve(buffer_pool::class_size(start + MAX_ENCODED_SIZE));
+            uint16_t wire_sequence = uint16_t(sequence);
+            msg.body.resize(start + sizeof(uint16_t));
+            std::memcpy(msg.body.data() + start, &wire_sequence, sizeof(uint16_t));
+            put_varint(msg.body, distance);
+            put_varint(msg.body, mask);
+            for (size_t i = 0; i < schema_type::FIELD_COUNT; i++) {
+                if (!(mask & (uint32_t(1) << i)))
+                    continue;
+                if (schema_.is_quantized(i)) {
+                    put_varint(msg.body, zigzag(current[i] - (*baseline)[i]));
+                } else {
+                    size_t at = msg.body.size();
+                    msg.body.resize(at + sizeof(uint32_t));
+                    std::memcpy(msg.body.data() + at, &current[i], sizeof(uint32_t));
+                }
+            }
+            msg.header.size = msg.size();
+
+            history_[sequence % HISTORY] = { sequence, current };
+            return wire_sequence;
+        }
+
+        // Takes the wire sequence the client reported; acks older than the current one are ignored.
+        void ack(uint16_t sequence) {
+            uint32_t acked = sequence_ - uint16_t(uint16_t(sequence_) - sequence);
+            if (acked != 0 && (acked_ == 0 || int32_t(acked - acked_) > 0))
+                acked_ = acked;
+        }
+
+        // Forces the next encode() to be a full snapshot, e.g. when the client reports it lost its baseline.
+        void reset() {
+            acked_ = 0;
+        }
+
+    private:
+        static constexpr size_t MAX_ENCODED_SIZE = sizeof(uint16_t) + 2 * 5 + schema_type::FIELD_COUNT * 5;
+
+        struct entry {
+            uint32_t sequence = 0;
+            typename schema_type::fields fields {};
+        };
+
+        schema_type schema_;
+        std::array<entry, delta_detail::HISTORY> history_ {};
+        uint32_t sequence_ = 0;
+        uint32_t acked_ = 0;
+    };
+
+    enum class delta_status {
+        applied,
+        // Not newer than the last applied state; latest-wins, so it is dropped.
+        stale,
+        // The baseline it refers to was never received or has aged out; the sender must reset().
+        missing_baseline,
+        malformed
+    };
+
+    // Client side of one delta stream. Keeps the states it applied so deltas against any recent ack can be resolved.
+    template <typename State>
+    class delta_decoder {
+    public:
+        using schema_type = delta_schema<State>;
+
+        explicit delta_decoder(schema_type schema): schema_(schema) {
+
+        }
+
+        // Decodes the whole body of msg into state. On applied, last_sequence() is the value to ack.
+        template <typename T>
+        delta_status decode(const message<T>& msg, State& state) {
+            using namespace delta_detail;
+            const uint8_t* in = msg.body.data();
+            const uint8_t* end = in + msg.body.size();
+
+            uint16_t wire_sequence;
+            uint32_t distance, mask;
+            if (size_t(end - in) < sizeof(uint16_t))
+                return delta_status::malformed;
+            std::memcpy(&wire_sequence, in, sizeof(uint16_t));
+            in += sizeof(uint16_t);
+            // Only the low 16 bits travel; the rest is recovered from the last applied sequence.
+            uint32_t sequence = last_ + uint32_t(int32_t(int16_t(uint16_t(wire_sequence - uint16_t(last_)))));
+            if (!get_varint(in, end, distance) || !get_varint(in, end, mask))
+                return delta_status::malformed;
+            if (schema_type::FIELD_COUNT < 32 && (mask >> schema_type::FIELD_COUNT) != 0)
+                return delta_status::malformed;
+
+            if (has_last_ && int32_t(sequence - last_) <= 0)
+                return delta_status::stale;
+
+            typename schema_type::fields fields {};
+            if (distance != 0) {
+                uint32_t baseline = sequence - distance;
+                const entry& base = history_[baseline % HISTORY];
+                if (distance >= HISTORY || base.sequence != baseline)
+                    return delta_status::missing_baseline;
+                fields = base.fields;
+            }
+
+            for (size_t i = 0; i < schema_type::FIELD_COUNT; i++) {
+                if (!(mask & (uint32_t(1) << i)))
+                    continue;
+                if (schema_.is_quantized(i)) {
+                    uint32_t diff;
+                    if (!get_varint(in, end, diff))
+                        return delta_status::malformed;
+                    fields[i] += unzigzag(diff);
+                } else {
+                    if (size_t(end - in) < sizeof(uint32_t))
+                        return delta_status::malformed;
+                    std::memcpy(&fields[i], in, sizeof(uint32_t));
+                    in += sizeof(uint32_t);
+                }
+            }
+            if (in != end)
+                return delta_status::malformed;
+
+            history_[sequence % HISTORY] = { sequence, fields };
+            last_ = sequence;
+            has_last_ = true;
+            state = schema_.from_fields(fields);
+            return delta_status::applied;
+        }
+
+        // Wire sequence of the last applied state, to be sent back to the encoder's ack().
+        uint16_t last_sequence() const {
+            return uint16_t(last_);
+        }
+
+    private:
+        static constexpr size_t HISTORY = delta_detail::HISTORY;
+
+        struct entry {
+            uint32_t sequence = 0;
+            typename schema_type::fields fields {};
+        };
+
+        schema_type schema_;
+        std::array<entry, HISTORY> history_ {};
+        uint32_t last_ = 0;
+        bool has_last_ = false;
+    };
+}
+
+#endif //NETCLIENT_NET_DELTA_H
@@ -0,0 +1,80 @@
+#ifndef NETCLIENT_NET_HANDSHAKE_H
+#define NETCLIENT_NET_HANDSHAKE_H
+
+#include "net_common.h"
+#include <random>
+
+namespace blcl::net {
+    // Feature bits each side advertises during the handshake. A feature is used towards a peer only if it advertised it.
+    enum capability: uint32_t {
+        // Can take bodies compressed with the bundled LZ codec (see net_compression.h).
+        CAP_COMPRESSION = 1u << 0,
+        // Answers control_frame::ping with control_frame::pong.
+        CAP_HEARTBEAT = 1u << 1,
+        // Client: acknowledges what it receives and can resume a session. Server: keeps what it sends for resumption.
+        CAP_RESUME = 1u << 2
+    };
+
+    // What this build can receive; advertised by both sides.
+    constexpr uint32_t LOCAL_CAPABILITIES = CAP_COMPRESSION | CAP_HEARTBEAT | CAP_RESUME;
+
+    // A client of a server with CAP_RESUME sends control_frame::ack after every ACK_STRIDE messages it receives.
+    constexpr uint64_t ACK_STRIDE = 32;
+
+    // Set in message_header::size of a frame the connection handles itself: there is no body and the low bits
+    // hold a control_frame. Such frames never reach on_message.
+    constexpr uint32_t CONTROL_FLAG = 0x40000000u;
+
+    enum class control_frame: uint32_t {
+        ping = 1,
+        pong = 2,
+        // ACK_STRIDE more messages arrived.
+        ack = 6,
+        // The rest are never sent: a server connection queues them to the incoming messages for update().
+        // Its socket closed; update() drops the connection right after its last message.
+        closed = 3,
+        // Its outgoing queue rose above the high watermark, or fell back below half of it.
+        congested = 4,
+        drained = 5
+    };
+
+    // The client's answer to the server's challenge.
+    struct client_hello {
+        uint64_t checksum = 0;
+        uint32_t capabilities = 0;
+        uint32_t reserved = 0;
+        // Token of the session to resume, or 0 for a new one, and how many of its messages the client has received.
+        uint64_t resume_token = 0;
+        uint64_t received = 0;
+    };
+
+    // Identifies a session issued over TCP after the challenge-response; the server writes it once validation passes.
+    struct session_info {
+        uint32_t id = 0;
+        uint32_t capabilities = 0;
+        uint64_t token = 0;
+        // Non-zero if this continues the session the client asked to resume; the messages it missed come first.
+        uint32_t resumed = 0;
+        uint32_t reserved = 0;
+    };
+
+    // A session token is all it takes to resume a session or to send datagrams as its client, and every client is
+    // told its own. So each one is read from the OS entropy source: a seeded PRNG such as mt19937_64 gives its
+    // whole state away after a few hundred outputs, which one client can collect by reconnecting. Never 0, which
+    // in client_hello means no session.
+    inline uint64_t make_session_token() {
+        thread_local std::random_device device;
+        uint64_t token = 0;
+        while (token == 0)
+            token = uint64_t(device()) << 32 | uint32_t(device());
+        return token;
+    }
+
+    // Takes as long whichever bits differ, so the time a check takes doesn't tell a guesser how close it was.
+    inline bool session_tokens_equal(uint64_t a, uint64_t b) {
+        volatile uint64_t diff = a ^ b;
+        return diff == 0;
+    }
+}
+
+#endif //NETCLIENT_NET_HANDSHAKE_H
@@ -0,0 +1,315 @@
+#ifndef NETCLIENT_NET_LOG_H
+#define NETCLIENT_NET_LOG_H
+
+#include "net_common.h"
+#include "net_mpsc_queue.h"
+#include <array>
+#include <cstdlib>
+#include <string_view>
+#include <thread>
+#include <variant>
+
+namespace blcl::net {
+    enum class log_level: uint8_t {
+        debug,
+        info,
+        warn,
+        error
+    };
+
+    // Text argument copied into the record, truncated, so the caller's buffer may go away right after logging.
+    struct log_string {
+        static constexpr size_t CAPACITY = 62;
+        std::array<char, CAPACITY> data {};
+        uint8_t size = 0;
+
+        log_string() = default;
+        explicit log_string(std::string_view s): size(uint8_t(std::min(s.size(), CAPACITY))) {
+            std::memcpy(data.data(), s.data(), size);
+        }
+    };
+
+    using log_value = std::variant<std::monostate, int64_t, uint64_t, double, bool, log_string, asio::ip::tcp::endpoint>;
+
+    // One log call, captured as raw values; turning it into text happens on the logger thread.
+    struct log_record {
+        static constexpr size_t MAX_ARGS = 4;
+        // A string literal with one {} per argument. nullptr marks a wake-up record with nothing to print.
+        const char* format = nullptr;
+        log_level level = log_level::info;
+        // Records from the same call site that the rate limit dropped since the last one it let through.
+        uint32_t suppressed = 0;
+        std::array<log_value, MAX_ARGS> args {};
+    };
+
+    // Process-wide asynchronous logger. Callers only copy their arguments into a record and push it onto a lock-free
+    // queue; a background thread formats and writes records in batches. A full queue drops the record rather than
+    // waiting, and each call site is rate limited. A call site is its format string, whatever the arguments: one
+    // site's records all share its budget, even when they differ, so a site can't flood the log by varying them.
+    class logger {
+    public:
+        static constexpr size_t QUEUE_CAPACITY = 4096;
+
+        static logger& instance() {
+            // Never destroyed: the I/O threads of a static server may still log during exit.
+            static logger* instance = new logger();
+            return *instance;
+        }
+
+        void set_level(log_level level) {
+            level_.store(level, std::memory_order_relaxed);
+        }
+
+        bool enabled(log_level level) const {
+            return level >= level_.load(std::memory_order_relaxed);
+        }
+
+        // Records per call site per second, in bursts of at most per_second; 0 disables rate limiting.
+        void set_rate_limit(uint32_t per_second) {
+            rate_limit_.store(per_second, std::memory_order_relaxed);
+        }
+
+        template <typename... Args>
+        void write(log_level level, const char* format, const Args&... args) {
+            static_assert(sizeof...(Args) <= log_record::MAX_ARGS, "Too many log arguments.");
+            if (!enabled(level))
+                return;
+
+            log_record record;
+            if (!admit(format, record.suppressed))
+                return;
+            record.format = format;
+            record.level = level;
+            size_t i = 0;
+            ((record.args[i++] = to_value(args)), ...);
+
+            if (stopped_.load(std::memory_order_acquire)) {
+                // The logger thread is going away (process exit); the caller pays for the write itself.
+                std::scoped_lock lock(late_mtx_);
+                write_now(record);
+                return;
+            }
+            if (queue_.try_push_back(std::move(record)))
+                pushed_.fetch_add(1, std::memory_order_release);
+            else
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            // Pushed after stop()'s last drain, nobody else would write it.
+            if (joined_.load(std::memory_order_seq_cst))
+                write_queued();
+        }
+
+        // Blocks until every record pushed before the call has been written. Not for I/O threads.
+        void flush() {
+            uint64_t target = pushed_.load(std::memory_order_acquire);
+            while (written_.load(std::memory_order_acquire) < target && !stopped_.load(std::memory_order_acquire))
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        uint64_t dropped() const {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        logger(): queue_(QUEUE_CAPACITY) {
+            thread_ = std::thread([this]() { run(); });
+            std::atexit([]() { instance().stop(); });
+        }
+
+        // Writers that see stopped_ write their records themselves, so it is set before the thread's last pass.
+        // Records pushed by writers that checked it just before are written once the thread is gone.
+        void stop() {
+            stopped_.store(true, std::memory_order_release);
+            stopping_.store(true, std::memory_order_release);
+            // Wake the thread; if the queue is full it is awake already.
+            queue_.try_push_back(log_record());
+            if (thread_.joinable())
+                thread_.join();
+            joined_.store(true, std::memory_order_seq_cst);
+            write_queued();
+        }
+
+        // Once the logger thread is gone: writes whatever is still queued, on whichever thread gets here first.
+        void write_queued() {
+            std::scoped_lock lock(late_mtx_);
+            queue_.drain([this](log_record record) {
+                write_now(record);
+            });
+        }
+
+        // Needs late_mtx_.
+        void write_now(const log_record& record) {
+            if (!record.format)
+                return;
+            std::string text;
+            format_record(record, text);
+            (record.level >= log_level::error ? std::cerr : std::cout) << text << std::flush;
+        }
+
+        void run() {
+            std::string out, err;
+            uint64_t reported_drops = 0;
+            while (true) {
+                queue_.wait();
+                uint64_t count = 0;
+                queue_.drain([&](log_record record) {
+                    if (!record.format)
+                        return;
+                    format_record(record, record.level >= log_level::error ? err : out);
+                    count++;
+                });
+
+                uint64_t drops = dropped_.load(std::memory_order_relaxed);
+                if (drops != reported_drops) {
+                    out += "[WARN] Logger queue full, dropped " + std::to_string(drops - reported_drops) + " records.\n";
+                    reported_drops = drops;
+                }
+                if (!out.empty()) {
+                    std::cout << out << std::flush;
+                    out.clear();
+                }
+                if (!err.empty()) {
+                    std::cerr << err << std::flush;
+                    err.clear();
+                }
+                written_.fetch_add(count, std::memory_order_release);
+
+                if (stopping_.load(std::memory_order_acquire) && queue_.empty())
+                    return;
+            }
+        }
+
+        // Lets a call site through while it stays within rate_limit_ records a second: each record pushes the
+        // site's theoretical arrival time one interval on, and a record that would push it more than a second past
+        // now is dropped. Unlike counting per calendar second, this never lets twice the limit through around the
+        // turn of a second. Sites share a small fixed table; one whose slot is taken by another site is never limited.
+        bool admit(const char* format, uint32_t& suppressed) {
+            uint32_t limit = rate_limit_.load(std::memory_order_relaxed);
+            if (limit == 0)
+                return true;
+
+            site& s = sites_[(reinterpret_cast<uintptr_t>(format) >> 3) % sites_.size()];
+            const char* key = s.format.load(std::memory_order_relaxed);
+            if (key == nullptr)
+                s.format.compare_exchange_strong(key, format, std::memory_order_relaxed);
+            if (key != nullptr && key != format)
+                return true;
+
+            constexpr int64_t BURST = std::chrono::nanoseconds(std::chrono::seconds(1)).count();
+            int64_t interval = BURST / limit;
+            int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            int64_t arrival = s.arrival.load(std::memory_order_relaxed);
+            while (true) {
+                int64_t next = std::max(arrival, now) + interval;
+                if (next - now > BURST) {
+                    s.suppressed.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (s.arrival.compare_exchange_weak(arrival, next, std::memory_order_relaxed))
+                    break;
+            }
+            suppressed = s.suppressed.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+
+        template <typename A>
+        static log_value to_value(const A& arg) {
+            if constexpr (std::is_same_v<A, bool>)
+                return arg;
+            else if constexpr (std::is_enum_v<A>)
+                return to_value(std::underlying_type_t<A>(arg));
+            else if constexpr (std::is_integral_v<A> && std::is_signed_v<A>)
+                return int64_t(arg);
+            else if constexpr (std::is_integral_v<A>)
+                return uint64_t(arg);
+            else if constexpr (std::is_floating_point_v<A>)
+                return double(arg);
+            else if constexpr (std::is_convertible_v<const A&, std::string_view>)
+                return log_string(std::string_view(arg));
+            else if constexpr (std::is_convertible_v<const A&, std::error_code>)
+                // Formatted here: a category may be a static that is destroyed at exit before the record is written.
+                return log_string(std::error_code(arg).message());
+            else if constexpr (std::is_same_v<A, asio::ip::tcp::endpoint>)
+                return arg;
+            else
+                static_assert(sizeof(A) == 0, "Unsupported log argument type.");
+        }
+
+        static void format_record(const log_record& record, std::string& out) {
+            static constexpr const char* PREFIX[] = { "[DEBUG] ", "[INFO] ", "[WARN] ", "[ERR] " };
+            out += PREFIX[int(record.level)];
+            size_t arg = 0;
+            for (const char* p = record.format; *p; p++) {
+                if (p[0] == '{' && p[1] == '}' && arg < record.args.size()) {
+                    append(out, record.args[arg++]);
+                    p++;
+                } else {
+                    out += *p;
+                }
+            }
+            if (record.suppressed > 0)
+                out += " (" + std::to_string(record.suppressed) + " similar suppressed)";
+            out += '\n';
+        }
+
+        static void append(std::string& out, const log_value& value) {
+            std::visit([&out](const auto& v) {
+                using V = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<V, std::monostate>) {
+                } else if constexpr (std::is_same_v<V, bool>) {
+                    out += v ? "true" : "false";
+                } else if constexpr (std::is_arithmetic_v<V>) {
+                    out += std::to_string(v);
+                } else if constexpr (std::is_same_v<V, log_string>) {
+                    out.append(v.data.data(), v.size);
+                } else {
+                    asio::error_code ec;
+                    out += v.address().to_string(ec) + ":" + std::to_string(v.port());
+                }
+            }, value);
+        }
+
+        struct site {
+            std::atomic<const char*> format { nullptr };
+            // steady_clock nanoseconds.
+            std::atomic<int64_t> arrival { 0 };
+            std::atomic<uint32_t> suppressed { 0 };
+        };
+
+        mpsc_queue<log_record> queue_;
+        std::thread thread_;
+        std::atomic<log_level> level_ { log_level::info };
+        std::atomic<uint32_t> rate_limit_ { 20 };
+        std::array<site, 256> sites_ {};
+        std::atomic<uint64_t> pushed_ { 0 };
+        std::atomic<uint64_t> written_ { 0 };
+        std::atomic<uint64_t> dropped_ { 0 };
+        std::atomic<bool> stopping_ { false };
+        std::atomic<bool> stopped_ { false };
+        // Set once the logger thread has been joined; the queue's consumer is then whoever holds late_mtx_.
+        std::atomic<bool> joined_ { false };
+        std::mutex late_mtx_;
+    };
+
+    template <typename... Args>
+    void log_debug(const char* format, const Args&... args) {
+        logger::instance().write(log_level::debug, format, args...);
+    }
+
+    template <typename... Args>
+    void log_info(const char* format, const Args&... args) {
+        logger::instance().write(log_level::info, format, args...);
+    }
+
+    template <typename... Args>
+    void log_warn(const char* format, const Args&... args) {
+        logger::instance().write(log_level::warn, format, args...);
+    }
+
+    template <typename... Args>
+    void log_error(const char* format, const Args&... args) {
+        logger::instance().write(log_level::error, format, args...);
+    }
+}
+
+#endif //NETCLIENT_NET_LOG_H
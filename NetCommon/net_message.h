@@ -2,6 +2,8 @@
 #define SIMPLENETWORKING_NET_MESSAGE_H
 
 #include "net_common.h"
+#include "net_buffer_pool.h"
+#include "net_schema.h"
 namespace blcl::net {
     template <typename T>
     struct message_header {
@@ -11,8 +13,11 @@ namespace blcl::net {
 
     template <typename T>
     struct message {
+        // Body storage comes from buffer_pool and goes back to it when the message is destroyed.
+        using body_type = std::vector<uint8_t, pool_allocator<uint8_t>>;
+
         message_header<T> header {};
-        std::vector<uint8_t> body;
+        body_type body;
 
         size_t size() const {
             return body.size();
@@ -34,6 +39,9 @@ namespace blcl::net {
                     "Type of data is not in standard layout thus not able to be serialized.");
 
             size_t i = msg.body.size();
+            // Grow straight to the next pool size class so chained pushes don't reallocate each time
+            if (i + sizeof(Data) > msg.body.capacity())
+                msg.body.reserve(buffer_pool::class_size(i + sizeof(Data)));
             // Reserve space for the data to be pushed
             msg.body.resize(msg.body.size() + sizeof(Data));
             // Copy the data into the newly allocated vector space
@@ -45,6 +53,24 @@ namespace blcl::net {
             return msg;
         }
 
+        // Appends data in its schema encoding (see net_schema.h). Unlike operator<<, fields written this way are
+        // read back front to back, through reader().
+        template <typename Data>
+        message<T>& write(const Data& data) {
+            constexpr size_t size = encoded_size<Data>();
+            size_t i = body.size();
+            if (i + size > body.capacity())
+                body.reserve(buffer_pool::class_size(i + size));
+            body.resize(i + size);
+            encode_to(data, body.data() + i);
+            header.size = this->size();
+            return *this;
+        }
+
+        schema_reader reader() const {
+            return schema_reader(std::span<const uint8_t>(body.data(), body.size()));
+        }
+
         template <typename Data>
         friend message<T>& operator>>(message<T>& msg, Data& data) {
             static_assert(std::is_standard_layout<Data>::value,
@@ -63,6 +89,50 @@ namespace blcl::net {
         }
     };
 
+    // Body of a shared_message, with room for the compressed form that every connection sending it would otherwise
+    // work out for itself; see compressed_form().
+    template <typename T>
+    struct shared_payload: message<T> {
+        explicit shared_payload(message<T>&& msg): message<T>(std::move(msg)) {
+
+        }
+
+        mutable std::once_flag packed_once;
+        // Null if compressing doesn't pay.
+        mutable std::shared_ptr<const shared_payload> packed;
+    };
+
+    // Immutable message that several connections' write queues can reference, e.g. for broadcasts.
+    template <typename T>
+    using shared_message = std::shared_ptr<const shared_payload<T>>;
+
+    template <typename T>
+    shared_message<T> make_shared_message(message<T> msg) {
+        return std::allocate_shared<shared_payload<T>>(pool_allocator<shared_payload<T>>(), std::move(msg));
+    }
+
+    // Lane of a connection's write queue. Lanes are drained by weighted round robin, so a reply sent as high
+    // doesn't wait behind a backlog of bulk traffic, while bulk still gets its share.
+    enum class priority: uint8_t {
+        high,
+        normal,
+        bulk
+    };
+
+    constexpr size_t PRIORITY_LANES = 3;
+
+    // Entry of a connection's write queue: either a message of its own or a reference to a shared one.
+    template <typename T>
+    struct outgoing_message {
+        message<T> msg;
+        shared_message<T> shared = nullptr;
+        priority lane = priority::normal;
+
+        const message<T>& get() const {
+            return shared ? *shared : msg;
+        }
+    };
+
     // Forward declare 'connection' class
     template <typename Data>
     class connection;
@@ -72,6 +142,8 @@ namespace blcl::net {
     {
         std::shared_ptr<connection<T>> remote = nullptr;
         message<T> msg;
+        // When the read that completed msg finished, for measuring how long it waited to be handled.
+        std::chrono::steady_clock::time_point received {};
 
         friend std::ostream& operator<<(std::ostream& os, const owned_message<T>& msg)
         {
@@ -0,0 +1,196 @@
+#ifndef NETCLIENT_NET_MPSC_QUEUE_H
+#define NETCLIENT_NET_MPSC_QUEUE_H
+#include "net_common.h"
+#include <atomic>
+#include <vector>
+
+namespace blcl::net {
+    // Parks one consumer until a producer rings. Several queues drained by the same thread can share one, so that
+    // thread can wait for whichever of them gets an item first.
+    class doorbell {
+    public:
+        // Blocks until ready() holds. Producers only issue a notify while the consumer is parked here, and the consumer
+        // checks a while before it parks, so a steady stream of pushes rarely costs a wake-up.
+        // ready() must observe, with a seq_cst load, what the producer's ring() follows a seq_cst read-modify-write of.
+        template <typename Ready>
+        void wait(Ready&& ready) {
+            for (int spin = 0; spin < SPIN_LIMIT; spin++) {
+                if (ready())
+                    return;
+            }
+            while (!ready()) {
+                uint32_t seq = wake_seq_.load(std::memory_order_acquire);
+                consumer_waiting_.store(true, std::memory_order_seq_cst);
+                if (ready()) {
+                    consumer_waiting_.store(false, std::memory_order_relaxed);
+                    break;
+                }
+                wake_seq_.wait(seq, std::memory_order_acquire);
+                consumer_waiting_.store(false, std::memory_order_relaxed);
+            }
+        }
+
+        // Called by a producer after the seq_cst read-modify-write that claimed its item. That orders this load
+        // against the consumer's store of the flag without a fence of its own on every push.
+        void ring() {
+            if (consumer_waiting_.load(std::memory_order_seq_cst) &&
+                consumer_waiting_.exchange(false, std::memory_order_relaxed)) {
+                wake_seq_.fetch_add(1, std::memory_order_release);
+                wake_seq_.notify_one();
+            }
+        }
+
+    private:
+        static constexpr int SPIN_LIMIT = 128;
+
+        alignas(64) std::atomic<uint32_t> wake_seq_ { 0 };
+        std::atomic<bool> consumer_waiting_ { false };
+    };
+
+    // Bounded lock-free multi-producer/single-consumer ring buffer.
+    // Any thread may push; front/pop/drain/wait must only be called from the one consumer thread.
+    template <typename T>
+    class mpsc_queue {
+    public:
+        static constexpr size_t DEFAULT_CAPACITY = 16384;
+
+        // capacity is rounded up to a power of two.
+        explicit mpsc_queue(size_t capacity = DEFAULT_CAPACITY)
+            : cells_(round_up_pow2(capacity)), mask_(cells_.size() - 1)
+        {
+            for (size_t i = 0; i < cells_.size(); i++)
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        mpsc_queue(const mpsc_queue<T>&) = delete;
+        virtual ~mpsc_queue() = default;
+
+    protected:
+        struct cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        std::vector<cell> cells_;
+        const size_t mask_;
+        alignas(64) std::atomic<size_t> tail_ { 0 };
+        // Only the consumer writes it; atomic so that size() may read it from other threads.
+        alignas(64) std::atomic<size_t> head_ { 0 };
+        doorbell own_doorbell_;
+        doorbell* doorbell_ = &own_doorbell_;
+
+    public:
+        // Returns false if the queue is full, in which case item is left untouched for the caller to retry or drop.
+        bool try_push_back(T&& item) {
+            size_t pos = tail_.load(std::memory_order_relaxed);
+            cell* c;
+            while (true) {
+                c = &cells_[pos & mask_];
+                size_t seq = c->sequence.load(std::memory_order_acquire);
+                intptr_t diff = intptr_t(seq) - intptr_t(pos);
+                if (diff == 0) {
+                    // seq_cst, which ring() relies on; on x86 it is the same locked instruction either way.
+                    if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+
+            c->data = std::move(item);
+            c->sequence.store(pos + 1, std::memory_order_release);
+            notify_consumer();
+            return true;
+        }
+
+        // Yields until there is room, which throttles producers when the consumer falls behind. Called from an I/O
+        // thread this stalls every connection on that thread's io_context until the consumer catches up, so it must
+        // never wait on a consumer that itself runs on an I/O thread; use try_push_back there.
+        void push_back(T item) {
+            while (!try_push_back(std::move(item)))
+                std::this_thread::yield();
+        }
+
+        bool empty() const {
+            size_t head = head_.load(std::memory_order_relaxed);
+            const cell& c = cells_[head & mask_];
+            return c.sequence.load(std::memory_order_acquire) != head + 1;
+        }
+
+        // True once a producer has claimed a cell, which may be a moment before its item shows up in empty().
+        // Consumer only; this is what the consumer waits on, since it is what a push is ordered against.
+        bool pending() const {
+            return tail_.load(std::memory_order_seq_cst) != head_.load(std::memory_order_relaxed);
+        }
+
+        // Approximate when called concurrently with producers or the consumer; safe from any thread.
+        size_t size() const {
+            size_t head = head_.load(std::memory_order_relaxed);
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            return tail > head ? tail - head : 0;
+        }
+
+        size_t capacity() const {
+            return cells_.size();
+        }
+
+        T& front() {
+            return cells_[head_.load(std::memory_order_relaxed) & mask_].data;
+        }
+
+        T pop_front() {
+            size_t head = head_.load(std::memory_order_relaxed);
+            cell& c = cells_[head & mask_];
+            T t = std::move(c.data);
+            c.data = T();
+            c.sequence.store(head + mask_ + 1, std::memory_order_release);
+            head_.store(head + 1, std::memory_order_relaxed);
+            return t;
+        }
+
+        // Hands every item currently in the queue (up to max_count) to fn in one pass.
+        template <typename Fn>
+        size_t drain(Fn&& fn, size_t max_count = -1) {
+            size_t count = 0;
+            while (count < max_count && !empty()) {
+                fn(pop_front());
+                count++;
+            }
+            return count;
+        }
+
+        void clear() {
+            while (!empty())
+                pop_front();
+        }
+
+        // Blocks until an item is available.
+        void wait() {
+            doorbell_->wait([this]() { return pending(); });
+            // A claimed cell is filled right after the claim.
+            while (empty())
+                std::this_thread::yield();
+        }
+
+        // Rings bell instead of the queue's own on every push; the consumer then waits on bell.
+        // Call before anything is pushed.
+        void share_doorbell(doorbell& bell) {
+            doorbell_ = &bell;
+        }
+
+    private:
+        void notify_consumer() {
+            doorbell_->ring();
+        }
+
+        static size_t round_up_pow2(size_t n) {
+            size_t p = 2;
+            while (p < n)
+                p <<= 1;
+            return p;
+        }
+    };
+}
+
+#endif //NETCLIENT_NET_MPSC_QUEUE_H
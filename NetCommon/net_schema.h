@@ -0,0 +1,175 @@
+#ifndef NETCLIENT_NET_SCHEMA_H
+#define NETCLIENT_NET_SCHEMA_H
+
+#include "net_common.h"
+#include <array>
+#include <cstring>
+#include <span>
+#include <tuple>
+
+namespace blcl::net {
+    // Declares the serialized fields of a struct, in wire order:
+    //     static constexpr auto schema = blcl::net::schema_fields(&State::type, &State::pos, &State::rot);
+    // Fields may be arithmetic, enums, std::array of those, or structs that declare a schema themselves.
+    // The encoding is little-endian with no padding, so its size is known at compile time.
+    template <typename... Members>
+    constexpr auto schema_fields(Members... members) {
+        return std::make_tuple(members...);
+    }
+
+    template <typename S>
+    concept schema_struct = requires { std::tuple_size<std::remove_cvref_t<decltype(S::schema)>>::value; };
+
+    namespace schema_detail {
+        template <typename M>
+        struct member_of;
+
+        template <typename C, typename F>
+        struct member_of<F C::*> {
+            using type = F;
+        };
+
+        template <typename V>
+        struct is_std_array: std::false_type { };
+
+        template <typename V, size_t N>
+        struct is_std_array<std::array<V, N>>: std::true_type { };
+
+        template <size_t N>
+        using unsigned_of = std::conditional_t<N == 1, uint8_t, std::conditional_t<N == 2, uint16_t,
+                            std::conditional_t<N == 4, uint32_t, uint64_t>>>;
+
+        template <typename V>
+        constexpr bool is_leaf = std::is_arithmetic_v<V> || std::is_enum_v<V>;
+    }
+
+    template <typename S>
+    constexpr size_t encoded_size() {
+        using namespace schema_detail;
+        if constexpr (is_leaf<S>) {
+            static_assert(sizeof(S) <= 8, "Leaf fields wider than 8 bytes are not supported.");
+            return sizeof(S);
+        } else if constexpr (is_std_array<S>::value) {
+            return encoded_size<typename S::value_type>() * std::tuple_size_v<S>;
+        } else {
+            static_assert(schema_struct<S>, "Type declares no schema; add a static constexpr schema = schema_fields(...).");
+            return std::apply([](auto... members) {
+                return (size_t(0) + ... + encoded_size<typename member_of<decltype(members)>::type>());
+            }, S::schema);
+        }
+    }
+
+    // Stack buffer that holds exactly one encoded S.
+    template <typename S>
+    using encoded_buffer = std::array<uint8_t, encoded_size<S>()>;
+
+    // Writes encoded_size<S>() bytes at out and returns the end; the caller guarantees the room.
+    template <typename S>
+    uint8_t* encode_to(const S& value, uint8_t* out) {
+        using namespace schema_detail;
+        if constexpr (is_leaf<S>) {
+            unsigned_of<sizeof(S)> bits;
+            std::memcpy(&bits, &value, sizeof(S));
+            for (size_t i = 0; i < sizeof(S); i++)
+                out[i] = uint8_t(bits >> (8 * i));
+            return out + sizeof(S);
+        } else if constexpr (is_std_array<S>::value) {
+            for (const auto& element: value)
+                out = encode_to(element, out);
+            return out;
+        } else {
+            std::apply([&](auto... members) { ((out = encode_to(value.*members, out)), ...); }, S::schema);
+            return out;
+        }
+    }
+
+    // Reads encoded_size<S>() bytes at in and returns the end; the caller guarantees they are there.
+    template <typename S>
+    const uint8_t* decode_from(S& value, const uint8_t* in) {
+        using namespace schema_detail;
+        if constexpr (std::is_same_v<S, bool>) {
+            // Any byte but 0 or 1 copied into a bool is undefined, and the bytes may come from a peer.
+            value = in[0] != 0;
+            return in + 1;
+        } else if constexpr (is_leaf<S>) {
+            unsigned_of<sizeof(S)> bits = 0;
+            for (size_t i = 0; i < sizeof(S); i++)
+                bits |= unsigned_of<sizeof(S)>(in[i]) << (8 * i);
+            std::memcpy(&value, &bits, sizeof(S));
+            return in + sizeof(S);
+        } else if constexpr (is_std_array<S>::value) {
+            for (auto& element: value)
+                in = decode_from(element, in);
+            return in;
+        } else {
+            std::apply([&](auto... members) { ((in = decode_from(value.*members, in)), ...); }, S::schema);
+            return in;
+        }
+    }
+
+    template <typename S>
+    encoded_buffer<S> encode(const S& value) {
+        encoded_buffer<S> buffer;
+        encode_to(value, buffer.data());
+        return buffer;
+    }
+
+    template <typename S>
+    bool decode(std::span<const uint8_t> bytes, S& value) {
+        if (bytes.size() < encoded_size<S>())
+            return false;
+        decode_from(value, bytes.data());
+        return true;
+    }
+
+    // Forward, bounds-checked, non-destructive cursor over encoded bytes such as a message body.
+    // A read past the end fails, leaves its target untouched and sticks: every later read fails too.
+    class schema_reader {
+    public:
+        explicit schema_reader(std::span<const uint8_t> bytes): bytes_(bytes) {
+
+        }
+
+        template <typename S>
+        bool read(S& value) {
+            constexpr size_t size = encoded_size<S>();
+            if (failed_ || bytes_.size() - offset_ < size) {
+                failed_ = true;
+                return false;
+            }
+            decode_from(value, bytes_.data() + offset_);
+            offset_ += size;
+            return true;
+        }
+
+        template <typename S>
+        schema_reader& operator>>(S& value) {
+            read(value);
+            return *this;
+        }
+
+        bool skip(size_t size) {
+            if (failed_ || bytes_.size() - offset_ < size) {
+                failed_ = true;
+                return false;
+            }
+            offset_ += size;
+            return true;
+        }
+
+        size_t remaining() const {
+            return bytes_.size() - offset_;
+        }
+
+        explicit operator bool() const {
+            return !failed_;
+        }
+
+    private:
+        std::span<const uint8_t> bytes_;
+        size_t offset_ = 0;
+        bool failed_ = false;
+    };
+}
+
+#endif //NETCLIENT_NET_SCHEMA_H
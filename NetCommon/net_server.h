@@ -4,125 +4,854 @@
 #include "net_common.h"
 #include "net_message.h"
 #include "net_tsqueue.h"
+#include "net_mpsc_queue.h"
 #include "net_connection.h"
+#include "net_udp.h"
+#include "net_spatial.h"
+#include "net_snapshot.h"
+#include "net_stats.h"
+#include "net_log.h"
+#include "net_slot_map.h"
+#include "net_timer_wheel.h"
+#include "net_admission.h"
+#include <bitset>
+#include <cassert>
+#include <fstream>
 
 namespace blcl::net {
     template <typename T>
     class server_interface {
+        struct shard_broadcast {
+            shared_message<T> msg;
+            std::shared_ptr<connection<T>> ignored_client;
+            priority lane;
+        };
+
+        // The clients of one io_context, with their own incoming queue. A shard's registry is only locked by its own
+        // I/O thread and by update(), so I/O threads don't contend for it.
+        struct shard {
+            shard(size_t index, asio::io_context& context, size_t capacity): index(index), context(context), connections(capacity) {
+
+            }
+
+            size_t index;
+            asio::io_context& context;
+            // Null for the shards that the first shard's acceptor accepts for.
+            asio::ip::tcp::acceptor* acceptor = nullptr;
+            std::unique_ptr<asio::ip::tcp::acceptor> owned_acceptor;
+            mpsc_queue<owned_message<T>> incoming_messages;
+            // Keyed by slot handle. Guarded by connections_mtx: the shard's I/O thread inserts, the update() thread removes.
+            slot_map<std::shared_ptr<connection<T>>> connections;
+            std::mutex connections_mtx;
+            // Resumable sessions by token, open or parked. A parked session's connection stays registered while it
+            // waits for its client to come back.
+            std::unordered_map<uint64_t, slot_handle> sessions;
+            connection_stats retired_stats;
+            // Broadcasts from other threads, fanned out on the shard's own thread.
+            mpsc_queue<shard_broadcast> mailbox;
+            std::atomic<bool> mailbox_scheduled = false;
+        };
+
     public:
-        server_interface(uint16_t port)
-            : asio_acceptor_(context_, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+        // thread_count == 0 picks one io_context per hardware thread.
+        // A sharded server splits into one shard per io_context, each with its own acceptor (bound with SO_REUSEPORT
+        // where the platform has it, so the kernel spreads incoming connections), connection registry and incoming
+        // queue; a shard's clients all live on its io_context. Otherwise one acceptor spreads clients over all contexts.
+        explicit server_interface(uint16_t port, size_t thread_count = 0, bool sharded = false)
+            : io_contexts_(make_io_contexts(thread_count)),
+            asio_acceptor_(*io_contexts_.front()),
+            write_latency_(io_contexts_.size())
         {
+            size_t shard_count = sharded ? io_contexts_.size() : 1;
+            for (size_t i = 0; i < shard_count; i++) {
+                shards_.push_back(std::make_unique<shard>(i, *io_contexts_[i], slot_map<std::shared_ptr<connection<T>>>::MAX_SIZE / shard_count));
+                shards_.back()->incoming_messages.share_doorbell(incoming_doorbell_);
+            }
 
+            asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), port);
+            open_acceptor(asio_acceptor_, endpoint, sharded);
+            shards_.front()->acceptor = &asio_acceptor_;
+#ifdef SO_REUSEPORT
+            // Port 0 means whichever port the first acceptor got.
+            endpoint.port(asio_acceptor_.local_endpoint().port());
+            for (size_t i = 1; i < shards_.size(); i++) {
+                shards_[i]->owned_acceptor = std::make_unique<asio::ip::tcp::acceptor>(*io_contexts_[i]);
+                open_acceptor(*shards_[i]->owned_acceptor, endpoint, true);
+                shards_[i]->acceptor = shards_[i]->owned_acceptor.get();
+            }
+#endif
         }
 
+        // A derived server must call stop() in its own destructor. By the time this one runs the derived part is
+        // gone, and an I/O thread still running could call its on_message or on_client_validated in the meantime.
         virtual ~server_interface() {
+            assert(ctx_threads_.empty() && "derived servers must call stop() in their destructor");
             stop();
         }
 
         bool start() {
             try {
-                wait_for_client_connection();
-                ctx_thread_ = std::thread([this]() { context_.run(); });
+                start_heartbeat();
+                for (auto& context: io_contexts_) {
+                    work_guards_.emplace_back(asio::make_work_guard(*context));
+                    ctx_threads_.emplace_back([&context]() { context->run(); });
+                }
+                for (auto& s: shards_)
+                    if (s->acceptor)
+                        wait_for_client_connection(*s);
             } catch (std::exception& e) {
-                std::cerr << "[ERR] Exception: " << e.what() << "\n";
+                log_error("Exception: {}", e.what());
                 return false;
             }
 
-            std::cout << "[INFO] Server started!\n";
+            log_info("Server started!");
             return true;
         }
 
+        // Joins the I/O threads. Does nothing if they have been stopped already.
         void stop() {
-            context_.stop();
-            if (ctx_thread_.joinable())
-                ctx_thread_.join();
+            if (ctx_threads_.empty())
+                return;
+            work_guards_.clear();
+            for (auto& context: io_contexts_)
+                context->stop();
+            for (auto& thread: ctx_threads_)
+                if (thread.joinable())
+                    thread.join();
+            ctx_threads_.clear();
+
+            log_info("Server Stopped!");
+        }
+
+        // Pings clients that have been silent for keepalive and drops those silent for idle_timeout, so half-open
+        // peers are reaped and on_client_disconnect fires for them. A zero duration turns either off. Call before start().
+        void enable_heartbeat(std::chrono::milliseconds keepalive, std::chrono::milliseconds idle_timeout) {
+            keepalive_ = keepalive;
+            idle_timeout_ = idle_timeout;
+        }
+
+        // Disconnects clients that send a message body larger than max_bytes, see connection::set_max_message_size().
+        // Call before start().
+        void set_max_message_size(size_t max_bytes) {
+            max_message_size_ = max_bytes;
+        }
+
+        // Bounds every client's outgoing queue, see outgoing_limits. With a high watermark set, on_client_congestion
+        // reports clients whose queue crosses it. Call before start().
+        void set_outgoing_limits(const outgoing_limits& limits) {
+            outgoing_limits_ = limits;
+        }
+
+        // Hands validated clients to accept() and their messages to connection::receive() rather than on_message.
+        // update() still has to run: it processes disconnects and congestion notices. Call before start().
+        void enable_direct_receive() {
+            direct_receive_ = true;
+        }
+
+        // async
+        // Next validated client, with enable_direct_receive() on. Spawn the coroutine that serves it on
+        // client->get_executor(), so receive() resumes it straight from the client's read handler.
+        // One accept() may be pending at a time.
+        asio::awaitable<std::shared_ptr<connection<T>>> accept() {
+            return asio::async_initiate<decltype(asio::use_awaitable), void(asio::error_code, std::shared_ptr<connection<T>>)>(
+                [this](auto handler) {
+                    std::scoped_lock lock(accepted_mtx_);
+                    accept_waiter_.set(std::move(handler));
+                    if (!accepted_.empty()) {
+                        auto client = std::move(accepted_.front());
+                        accepted_.pop_front();
+                        accept_waiter_.post({}, std::move(client));
+                    }
+                }, asio::use_awaitable);
+        }
+
+        // Runs on_message on the I/O thread that read the message instead of queueing it for update(), which saves
+        // the hop to the update() thread for handlers that only reply or relay. See on_message for what such a
+        // handler may do. Applies to TCP messages of clients not handed to accept(). Call before start().
+        void enable_inline_dispatch() {
+            inline_all_ = true;
+        }
 
-            std::cout << "[INFO] Server Stopped!\n";
+        // Like enable_inline_dispatch(), for messages with this id only. Ids from INLINE_ID_LIMIT up are always queued.
+        void enable_inline_dispatch(T id) {
+            if (size_t(id) < INLINE_ID_LIMIT)
+                inline_ids_.set(size_t(id));
+        }
+
+        // Turns away an address once it has made more than max_attempts connection attempts, a failed challenge-response
+        // counting HANDSHAKE_FAILURE_WEIGHT of them; the count halves every half_life. A rejected socket is closed
+        // right after accept, before anything is allocated for it. Call before start().
+        void set_admission_limit(uint32_t max_attempts, std::chrono::steady_clock::duration half_life = std::chrono::minutes(1)) {
+            admission_ = std::make_unique<admission_controller>(max_attempts, half_life);
+        }
+
+        // Keeps a session for window after its connection closes. A client that reconnects in time with the session's
+        // token gets it back: the same ID, and the messages it missed, of which each session keeps up to replay_limit
+        // that the client hasn't acknowledged. Until the window is over the application sees no disconnect;
+        // on_client_resumed hands it the new connection, which get_client() returns from then on. Call before start().
+        void enable_session_resumption(std::chrono::steady_clock::duration window, size_t replay_limit = 1024) {
+            resume_window_ = window;
+            replay_limit_ = replay_limit;
+        }
+
+        // Compresses outgoing bodies of at least threshold bytes for clients that can take them. Call before start().
+        void enable_compression(size_t threshold = 1024) {
+            compression_threshold_ = threshold;
+        }
+
+        // Opens a UDP socket on the server's port for send_unreliable()/broadcast_message_unreliable().
+        // Clients bind to it with the session token they were given after the challenge-response.
+        bool enable_unreliable_channel() {
+            try {
+                udp_ = std::make_unique<udp_channel<T>>(*io_contexts_.front(),
+                        asio::ip::udp::endpoint(asio::ip::udp::v4(), asio_acceptor_.local_endpoint().port()),
+                        [this](const asio::ip::udp::endpoint& sender, const udp_header& header, const uint8_t* payload, size_t size) {
+                            on_udp_datagram(sender, header, payload, size);
+                        });
+                udp_->start();
+            } catch (std::exception& e) {
+                log_error("Exception: {}", e.what());
+                return false;
+            }
+            return true;
+        }
+
+        udp_channel<T>* get_unreliable_channel() {
+            return udp_.get();
         }
 
         // async
-        void wait_for_client_connection() {
-            asio_acceptor_.async_accept(
-                    [this](std::error_code ec, asio::ip::tcp::socket socket) {
-                        if (!ec) {
-                            std::cout << "[INFO] New connection: " << socket.remote_endpoint() << "\n";
+        void wait_for_client_connection(shard& acceptor_shard) {
+            // Sockets are opened on the io_context of the shard they join, so the connection's handlers run there:
+            // a sharded server's own, or the next one of the pool. Without SO_REUSEPORT, the first shard's acceptor
+            // accepts for every shard in turn.
+            bool own_acceptors = shards_.size() > 1 && shards_.back()->acceptor;
+            shard& s = own_acceptors ? acceptor_shard : next_shard();
+            size_t context_index = shards_.size() > 1 ? s.index : next_io_context_index();
+            asio::io_context& context = *io_contexts_[context_index];
+            acceptor_shard.acceptor->async_accept(context,
+                    [this, &acceptor_shard, &s, &context, context_index](std::error_code ec, asio::ip::tcp::socket socket) {
+                        // The peer may already be gone; that surfaces on the first read, not here.
+                        asio::error_code endpoint_ec;
+                        asio::ip::tcp::endpoint endpoint = ec ? asio::ip::tcp::endpoint() : socket.remote_endpoint(endpoint_ec);
+                        if (!ec && admission_ && !endpoint_ec && !admission_->admit(endpoint.address())) {
+                            // Closing the socket is all a rejected attempt costs.
+                            log_warn("Connection refused: {} is over the admission limit.", endpoint);
+                        } else if (!ec) {
+                            log_info("New connection: {}", endpoint);
 
                             std::shared_ptr<connection<T>> new_connection =
                                     std::make_shared<connection<T>>(
-                                            connection<T>::owner::server, context_, std::move(socket), incoming_messages_);
+                                            connection<T>::owner::server, context, std::move(socket), s.incoming_messages);
+                            new_connection->set_compression(compression_threshold_);
+                            new_connection->set_outgoing_limits(outgoing_limits_);
+                            new_connection->set_max_message_size(max_message_size_);
+                            new_connection->set_direct_receive(direct_receive_);
+                            new_connection->set_replay_limit(resume_window_.count() > 0 ? replay_limit_ : 0);
+                            new_connection->set_write_latency_histogram(&write_latency_[context_index]);
 
                             if (on_client_connect(new_connection)) {
-                                connections_.push_back(std::move(new_connection));
-                                connections_.back()->connect_to_client(this, id_counter_++);
-                                std::cout << "[INFO] Connection established. Connection ID: " << connections_.back()->get_id() << '\n';
+                                // The connection ID is its registry handle, so get_client() finds it without a search.
+                                std::scoped_lock lock(s.connections_mtx);
+                                slot_handle handle = s.connections.insert(new_connection);
+                                if (handle != slot_map<std::shared_ptr<connection<T>>>::INVALID) {
+                                    uint32_t id = client_id(s, handle);
+                                    new_connection->connect_to_client(this, id);
+                                    log_info("Connection established. Connection ID: {}", id);
+                                    watch_liveness(context_index, new_connection);
+                                } else {
+                                    log_warn("Connection refused: connection registry is full.");
+                                }
                             } else {
-                                std::cout << "[WARN] Client disconnected on checking preconditions (likely fail2ban).\n";
+                                log_warn("Client disconnected on checking preconditions (likely fail2ban).");
                             }
                         } else {
-                            std::cout << "[WARN] Connection error occurred: " << ec.message() << "\n";
+                            log_warn("Connection error occurred: {}", ec);
                         }
 
-                        wait_for_client_connection();
+                        wait_for_client_connection(acceptor_shard);
                     });
         }
 
-        void send_message_to_client(std::shared_ptr<connection<T>> client, const message<T>& msg) {
-            if (client && client->is_connected()) {
-                client->send(msg);
+        void send_message_to_client(std::shared_ptr<connection<T>> client, const message<T>& msg, priority lane = priority::normal) {
+            send_message_to_client(std::move(client), message<T>(msg), lane);
+        }
+
+        // A client that has closed is left for update() to drop when its closed notice comes through, so this and
+        // the broadcasts are safe to call from any thread. A parked session keeps what is sent to it for its client.
+        void send_message_to_client(std::shared_ptr<connection<T>> client, message<T>&& msg, priority lane = priority::normal) {
+            if (client && client->is_reachable())
+                client->send(std::move(msg), lane);
+        }
+
+        // The connection with the given ID, or nullptr if it has gone away. The ID of a dropped connection does not
+        // resolve to a newer connection that took over its registry slot, until that slot has been reused
+        // slot_map::MAX_GENERATION (4095) more times; code that keeps IDs around longer than that should hold the
+        // connection itself, or check what it gets back.
+        std::shared_ptr<connection<T>> get_client(uint32_t id) {
+            auto [s, handle] = locate(id);
+            std::scoped_lock lock(s.connections_mtx);
+            auto* client = s.connections.find(handle);
+            return client ? *client : nullptr;
+        }
+
+        void broadcast_message(const message<T>& msg, std::shared_ptr<connection<T>> ignored_client = nullptr,
+                               priority lane = priority::normal) {
+            broadcast_message(make_shared_message(msg), std::move(ignored_client), lane);
+        }
+
+        void broadcast_message(message<T>&& msg, std::shared_ptr<connection<T>> ignored_client = nullptr,
+                               priority lane = priority::normal) {
+            broadcast_message(make_shared_message(std::move(msg)), std::move(ignored_client), lane);
+        }
+
+        // Every recipient's write queue references the same immutable msg instead of holding its own copy.
+        // A sharded server hands msg to each other shard's mailbox, and that shard's thread fans it out to its clients.
+        // A full mailbox is bypassed with a post of its own rather than waited on: the broadcast may come from another
+        // shard's thread, and two shards waiting on each other's mailboxes would never drain them.
+        void broadcast_message(shared_message<T> msg, std::shared_ptr<connection<T>> ignored_client = nullptr,
+                               priority lane = priority::normal) {
+            if (shards_.size() == 1) {
+                fan_out(*shards_.front(), msg, ignored_client, lane);
                 return;
             }
+            for (auto& s: shards_) {
+                if (s->context.get_executor().running_in_this_thread()) {
+                    fan_out(*s, msg, ignored_client, lane);
+                    continue;
+                }
+                shard_broadcast b { msg, ignored_client, lane };
+                if (s->mailbox.try_push_back(std::move(b))) {
+                    schedule_mailbox(*s);
+                } else {
+                    // Posted behind the drain that is already scheduled, so it still goes out after what is queued.
+                    asio::post(s->context, [this, &target = *s, b = std::move(b)]() {
+                        fan_out(target, b.msg, b.ignored_client, b.lane);
+                    });
+                }
+            }
+        }
 
-            on_client_disconnect(client);
-            client.reset();
-            connections_.erase(
-                    std::remove(connections_.begin(), connections_.end(), client), connections_.end());
+        // Interest management. These must be called from the thread running update(), typically from on_message.
+        // False, and the client's last position is kept, if pos has a NaN or infinite coordinate.
+        bool update_client_position(const std::shared_ptr<connection<T>>& client, const vec3& pos) {
+            return interest_grid_.update(client->get_id(), client, pos);
         }
 
-        void broadcast_message(const message<T>& msg, std::shared_ptr<connection<T>> ignored_client = nullptr) {
-            bool invalid_client_exists = false;
+        void remove_client_position(const std::shared_ptr<connection<T>>& client) {
+            interest_grid_.remove(client->get_id());
+        }
 
-            for (auto& client: connections_) {
-                if (client && client->is_connected()) {
-                    if (client != ignored_client && client->is_validated())
-                        client->send(msg);
-                } else {
-                    on_client_disconnect(client);
-                    client.reset();
-                    invalid_client_exists = true;
+        // Like broadcast_message, but only to clients whose last reported position is within radius of origin.
+        void broadcast_nearby(const message<T>& msg, const vec3& origin, float radius, std::shared_ptr<connection<T>> ignored_client = nullptr) {
+            shared_message<T> shared;
+            interest_grid_.query(origin, radius, [&](uint32_t id, const std::shared_ptr<connection<T>>& client, const vec3& pos) {
+                if (client == ignored_client || !client->is_validated() || !client->is_reachable())
+                    return;
+                if (!shared)
+                    shared = make_shared_message(msg);
+                client->send(shared);
+            });
+        }
+
+        // Latest-wins fan-out over UDP; clients without a bound UDP endpoint get msg over TCP instead.
+        void broadcast_message_unreliable(const message<T>& msg, std::shared_ptr<connection<T>> ignored_client = nullptr) {
+            for (auto& s: shards_) {
+                std::scoped_lock lock(s->connections_mtx);
+                for (auto& client: s->connections) {
+                    if (client->is_connected() && client != ignored_client && client->is_validated())
+                        client->send_unreliable(msg);
                 }
             }
+        }
+
+        // Runs the server on a fixed tick until stop_ticks() is called: each tick drains the incoming queue through
+        // on_message, calls on_tick(dt), then sends the state updates queued during the tick as one snapshot
+        // message with id snapshot_id. Outgoing snapshot rate is capped at tick_rate no matter how fast clients send.
+        void run_ticks(double tick_rate, T snapshot_id) {
+            using clock = std::chrono::steady_clock;
+            auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / tick_rate));
+
+            ticking_ = true;
+            auto last = clock::now();
+            auto next = last + period;
+            while (ticking_.load(std::memory_order_relaxed)) {
+                update(-1, false);
 
-            if (invalid_client_exists)
-                connections_.erase(
-                        std::remove(connections_.begin(), connections_.end(), nullptr), connections_.end());
+                auto now = clock::now();
+                on_tick(std::chrono::duration<double>(now - last).count());
+                last = now;
+                flush_snapshot(snapshot_id);
+
+                std::this_thread::sleep_until(next);
+                next += period;
+                // Don't try to catch up on ticks that were missed entirely.
+                if (next < clock::now())
+                    next = clock::now() + period;
+            }
+        }
+
+        void stop_ticks() {
+            ticking_ = false;
+        }
+
+        // Queues client's latest state for the next snapshot, replacing whatever it sent earlier in the same tick.
+        // Must be called from the thread running update().
+        void queue_state_update(const std::shared_ptr<connection<T>>& client, message<T>&& msg) {
+            snapshot_batcher_.submit(client->get_id(), std::move(msg));
+        }
+
+        // Sends everything queued by queue_state_update() to every validated client, in snapshots of up to
+        // MAX_MSG_SIZE bytes: above that, a receiver takes the message but logs a warning for each. Each client gets
+        // every other client's update but not its own: the snapshot holding it is shared by everyone else and sent to
+        // it as a copy without that entry. The snapshots of a tick all have id snapshot_id but hold different
+        // clients' updates, so don't pair it with overflow_policy::coalesce.
+        // run_ticks() calls this once per tick; custom loops can call it themselves.
+        void flush_snapshot(T snapshot_id) {
+            if (snapshot_batcher_.empty())
+                return;
+
+            auto batches = snapshot_batcher_.flush(snapshot_id);
+            std::vector<shared_message<T>> shared;
+            shared.reserve(batches.size());
+            std::unordered_map<uint32_t, size_t> origin;
+            for (size_t i = 0; i < batches.size(); i++) {
+                for (uint32_t id: batches[i].client_ids)
+                    origin.emplace(id, i);
+                shared.push_back(make_shared_message(std::move(batches[i].msg)));
+            }
+
+            for (auto& s: shards_) {
+                std::scoped_lock lock(s->connections_mtx);
+                for (auto& client: s->connections) {
+                    if (!client->is_reachable() || !client->is_validated())
+                        continue;
+                    auto it = origin.find(client->get_id());
+                    for (size_t i = 0; i < shared.size(); i++) {
+                        if (it == origin.end() || it->second != i)
+                            client->send(shared[i]);
+                        else if (batches[i].client_ids.size() > 1)
+                            client->send(snapshot_batcher<T>::without(*shared[i], it->first));
+                    }
+                }
+            }
         }
 
+        // Drains the incoming queues of all shards, taking up to max_message_count messages from each.
         void update(size_t max_message_count = -1, bool wait = true) {
-            if (wait)
-                incoming_messages_.wait();
+            if (wait) {
+                incoming_doorbell_.wait([this]() {
+                    return std::any_of(shards_.begin(), shards_.end(), [](const auto& s) { return s->incoming_messages.pending(); });
+                });
+            }
 
-            size_t message_count = 0;
-            while (message_count < max_message_count && !incoming_messages_.empty()) {
-                auto msg = incoming_messages_.pop_front();
-                on_message(msg.remote, msg.msg);
-                message_count++;
+            for (auto& s: shards_) {
+                s->incoming_messages.drain([this](owned_message<T> msg) {
+                    if (msg.msg.header.size & CONTROL_FLAG) {
+                        on_connection_notice(msg.remote, control_frame(msg.msg.header.size & ~CONTROL_FLAG));
+                        return;
+                    }
+                    dispatch_latency_.record(std::chrono::steady_clock::now() - msg.received);
+                    on_message(msg.remote, msg.msg);
+                }, max_message_count);
             }
         }
 
+        // Safe to call from any thread while the server runs.
+        server_stats get_stats() {
+            server_stats stats;
+            for (auto& s: shards_) {
+                std::scoped_lock lock(s->connections_mtx);
+                stats.totals.merge(s->retired_stats);
+                for (const auto& client: s->connections) {
+                    connection_stats c = client->get_stats();
+                    stats.max_outgoing_queue_depth = std::max(stats.max_outgoing_queue_depth, c.outgoing_queue_depth);
+                    stats.totals.merge(c);
+                    stats.connections++;
+                }
+                stats.incoming_queue_depth += s->incoming_messages.size();
+            }
+            for (const auto& histogram: write_latency_)
+                stats.write_latency.merge(histogram.snapshot());
+            stats.dispatch_latency = dispatch_latency_.snapshot();
+            return stats;
+        }
+
+        // Writes get_stats() to path as JSON, or as "key value" lines if json is false, replacing the file
+        // in one rename so a reader polling it never sees half a snapshot.
+        bool dump_stats(const std::string& path, bool json = true) {
+            server_stats stats = get_stats();
+            std::string tmp = path + ".tmp";
+            {
+                std::ofstream out(tmp, std::ios::trunc);
+                if (!out)
+                    return false;
+                out << (json ? stats.to_json() : stats.to_text());
+                if (!out)
+                    return false;
+            }
+            return std::rename(tmp.c_str(), path.c_str()) == 0;
+        }
+
     protected:
         virtual bool on_client_connect(std::shared_ptr<connection<T>> client) { return false; }
         virtual void on_client_disconnect(std::shared_ptr<connection<T>> client) { }
+        // msg is owned by the handler for the duration of the call; it may be moved into send() instead of copied.
+        // Runs on the update() thread, unless enable_inline_dispatch() picked msg's id: then it runs on an I/O thread,
+        // one message at a time per client but concurrently for different clients. An inline handler must not block
+        // and must leave alone whatever only the update() thread touches: queue_state_update(), the interest
+        // management calls, flush_snapshot(), and any state of its own it shares with queued handlers without a lock.
+        // Sending, broadcasting and get_client() are safe anywhere.
         virtual void on_message(std::shared_ptr<connection<T>> client, message<T>& msg) { }
-    public:
         virtual void on_client_validated(std::shared_ptr<connection<T>> client) { }
+        // client took over a parked session and carries on as the same client, with the same ID; called in place of
+        // on_client_validated. A connection kept from before passes whatever is still sent to it on to client.
+        virtual void on_client_resumed(std::shared_ptr<connection<T>> client) { }
+        // client's outgoing queue rose above the high watermark (congested) or drained below half of it.
+        // Called from update(); client->would_block() reflects the same state from any thread.
+        virtual void on_client_congestion(std::shared_ptr<connection<T>> client, bool congested) { }
+        virtual void on_tick(double dt) { }
+    public:
+        // Called by a connection's read handler for each message; true if on_message took it then and there.
+        bool dispatch_inline(connection<T>& client, message<T>& msg) {
+            size_t id = size_t(msg.header.id);
+            if (!inline_all_ && (id >= INLINE_ID_LIMIT || !inline_ids_.test(id)))
+                return false;
+            on_message(client.shared_from_this(), msg);
+            return true;
+        }
+
+        // Called by a connection, on its strand, whose client asked to resume the session behind token. Moves the
+        // connection into the session's registry slot and has it take the session over, from a parked connection or
+        // from one that still looks open but that the client has given up on. Does nothing if there is no such
+        // session or it no longer holds everything the client missed; the client then gets a new one.
+        void resume_session(const std::shared_ptr<connection<T>>& client, uint64_t token, uint64_t received) {
+            uint32_t temporary_id = client->get_id();
+            auto [t, temporary] = locate(temporary_id);
+            for (auto& s: shards_) {
+                // Both registries are locked across the takeover, so that every send to the old connection reaches
+                // it before the takeover's handover does, and a broadcast finds the client in exactly one slot.
+                std::unique_lock session_lock(s->connections_mtx, std::defer_lock);
+                std::unique_lock temporary_lock(t.connections_mtx, std::defer_lock);
+                if (s.get() == &t)
+                    session_lock.lock();
+                else
+                    std::lock(session_lock, temporary_lock);
+
+                auto session = s->sessions.find(token);
+                if (session == s->sessions.end())
+                    continue;
+                auto* registered = s->connections.find(session->second);
+                uint32_t id = client_id(*s, session->second);
+                if (!registered || !client->take_over(**registered, id, received))
+                    return;
+                retire_stats(*s, *registered);
+                *registered = client;
+                // Give up the slot the connection got when it was accepted.
+                t.connections.erase(temporary);
+                log_info("{}: Session {} resumed from message {}.", temporary_id, id, received);
+                return;
+            }
+        }
+
+        // Called by a connection whose challenge-response failed.
+        void handshake_failed(const asio::ip::address& address) {
+            if (admission_)
+                admission_->penalize(address, HANDSHAKE_FAILURE_WEIGHT);
+        }
+
+        // Called by a connection once its challenge-response passed.
+        void client_validated(std::shared_ptr<connection<T>> client) {
+            // A resumed session takes over the entry of the connection it continues.
+            if (udp_) {
+                std::scoped_lock lock(udp_sessions_mtx_);
+                udp_sessions_[client->get_id()] = client;
+            }
+            if (client->is_resumable() && !client->get_session().resumed) {
+                auto [s, handle] = locate(client->get_id());
+                std::scoped_lock lock(s.connections_mtx);
+                s.sessions[client->get_session().token] = handle;
+            }
+            client->attach_udp(udp_.get());
+            if (client->get_session().resumed)
+                on_client_resumed(client);
+            else
+                on_client_validated(client);
+
+            if (direct_receive_) {
+                std::scoped_lock lock(accepted_mtx_);
+                if (accept_waiter_)
+                    accept_waiter_.post({}, std::move(client));
+                else
+                    accepted_.push_back(std::move(client));
+            }
+        }
+    private:
+        void release_client_state(const std::shared_ptr<connection<T>>& client) {
+            remove_client_position(client);
+            snapshot_batcher_.forget(client->get_id());
+        }
+
+        void on_connection_notice(const std::shared_ptr<connection<T>>& client, control_frame notice) {
+            switch (notice) {
+                case control_frame::closed:
+                    // The socket is gone and this was the connection's last message.
+                    drop_client(client);
+                    break;
+                case control_frame::congested:
+                case control_frame::drained:
+                    if (client->is_connected())
+                        on_client_congestion(client, notice == control_frame::congested);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // A resumable session is parked on its first closed notice, and dropped on the second, which comes once the
+        // resumption window is over. A connection that a reconnect has taken the slot from is no longer registered.
+        void drop_client(const std::shared_ptr<connection<T>>& client) {
+            auto [s, handle] = locate(client->get_id());
+            {
+                std::scoped_lock lock(s.connections_mtx);
+                auto* registered = s.connections.find(handle);
+                if (!registered || *registered != client)
+                    return;
+                if (client->is_resumable() && client->park(resume_window_))
+                    return;
+                s.sessions.erase(client->get_session().token);
+                remove_client(s, handle);
+            }
+            forget_udp_session(client);
+            // Outside the lock, so the handler may broadcast or call get_client(), which take it.
+            on_client_disconnect(client);
+            release_client_state(client);
+        }
+
+        // One timer wheel per io_context, advanced by a single steady_timer on that context; only its thread touches it.
+        struct heartbeat_wheel {
+            asio::steady_timer timer;
+            timer_wheel<std::weak_ptr<connection<T>>> wheel { 0 };
+        };
+
+        static constexpr std::chrono::milliseconds HEARTBEAT_TICK { 50 };
+
+        void start_heartbeat() {
+            if (keepalive_.count() == 0 && idle_timeout_.count() == 0)
+                return;
+            heartbeat_epoch_ = std::chrono::steady_clock::now();
+            for (auto& context: io_contexts_) {
+                heartbeat_wheels_.push_back(std::make_unique<heartbeat_wheel>(heartbeat_wheel { asio::steady_timer(*context) }));
+                advance_heartbeat(*heartbeat_wheels_.back());
+            }
+        }
+
+        // async
+        void advance_heartbeat(heartbeat_wheel& hb) {
+            hb.timer.expires_after(HEARTBEAT_TICK);
+            hb.timer.async_wait([this, &hb](std::error_code ec) {
+                if (ec)
+                    return;
+                auto now = std::chrono::steady_clock::now();
+                hb.wheel.advance(heartbeat_tick(now), [&](std::weak_ptr<connection<T>>&& client) {
+                    check_liveness(hb, std::move(client), now);
+                });
+                advance_heartbeat(hb);
+            });
+        }
+
+        // Called from the acceptor; the first check runs on the connection's own io_context.
+        void watch_liveness(size_t context_index, const std::shared_ptr<connection<T>>& client) {
+            if (heartbeat_wheels_.empty())
+                return;
+            heartbeat_wheel& hb = *heartbeat_wheels_[context_index];
+            asio::post(*io_contexts_[context_index], [this, &hb, client = std::weak_ptr<connection<T>>(client)]() mutable {
+                check_liveness(hb, std::move(client), std::chrono::steady_clock::now());
+            });
+        }
+
+        void check_liveness(heartbeat_wheel& hb, std::weak_ptr<connection<T>>&& weak, std::chrono::steady_clock::time_point now) {
+            auto client = weak.lock();
+            if (!client)
+                return;
+            auto next = client->check_liveness(now, keepalive_, idle_timeout_);
+            if (next)
+                hb.wheel.schedule(heartbeat_tick(*next), std::move(weak));
+        }
+
+        // Rounds up, so a check never runs before the time it was scheduled for.
+        uint64_t heartbeat_tick(std::chrono::steady_clock::time_point time) const {
+            auto elapsed = std::max(time - heartbeat_epoch_, std::chrono::steady_clock::duration::zero());
+            return uint64_t((elapsed + HEARTBEAT_TICK - std::chrono::nanoseconds(1)) / HEARTBEAT_TICK);
+        }
+
+        // Unregisters a connection, keeping its counters in the server totals. Needs the shard's connections_mtx;
+        // the caller runs on_client_disconnect once it has let go of it.
+        void remove_client(shard& s, slot_handle handle) {
+            retire_stats(s, *s.connections.find(handle));
+            s.connections.erase(handle);
+        }
+
+        // Keeps the counters of a connection that is being dropped in the server totals. Needs the shard's connections_mtx.
+        void retire_stats(shard& s, const std::shared_ptr<connection<T>>& client) {
+            connection_stats c = client->get_stats();
+            c.outgoing_queue_depth = 0;
+            for (auto& lane: c.lanes)
+                lane.queue_depth = 0;
+            s.retired_stats.merge(c);
+        }
+
+        // Sends msg to the validated clients of one shard.
+        void fan_out(shard& s, const shared_message<T>& msg, const std::shared_ptr<connection<T>>& ignored_client, priority lane) {
+            std::scoped_lock lock(s.connections_mtx);
+            for (auto& client: s.connections) {
+                if (client->is_reachable() && client != ignored_client && client->is_validated())
+                    client->send(msg, lane);
+            }
+        }
+
+        // Has the shard's thread drain its mailbox, unless a drain is already on its way.
+        void schedule_mailbox(shard& s) {
+            if (s.mailbox_scheduled.exchange(true, std::memory_order_acq_rel))
+                return;
+            asio::post(s.context, [this, &s]() {
+                // Cleared first: a broadcast pushed during the drain schedules another rather than being missed.
+                s.mailbox_scheduled.store(false, std::memory_order_release);
+                s.mailbox.drain([&](shard_broadcast b) {
+                    fan_out(s, b.msg, b.ignored_client, b.lane);
+                });
+            });
+        }
+
+        // Connection IDs are slot handles with the shard folded into the index: index * shard count + shard.
+        // With a single shard they are the handles themselves.
+        uint32_t client_id(const shard& s, slot_handle handle) const {
+            uint32_t index = handle & slot_map<std::shared_ptr<connection<T>>>::INDEX_MASK;
+            return (handle & ~slot_map<std::shared_ptr<connection<T>>>::INDEX_MASK) | uint32_t(index * shards_.size() + s.index);
+        }
+
+        std::pair<shard&, slot_handle> locate(uint32_t id) {
+            uint32_t stripe = id & slot_map<std::shared_ptr<connection<T>>>::INDEX_MASK;
+            return { *shards_[stripe % shards_.size()],
+                     (id & ~slot_map<std::shared_ptr<connection<T>>>::INDEX_MASK) | uint32_t(stripe / shards_.size()) };
+        }
+
+        static void open_acceptor(asio::ip::tcp::acceptor& acceptor, const asio::ip::tcp::endpoint& endpoint, bool reuse_port) {
+            acceptor.open(endpoint.protocol());
+            acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+            if (reuse_port)
+                acceptor.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+            acceptor.bind(endpoint);
+            acceptor.listen();
+        }
+
+        // The entry would otherwise stay until a datagram arrived for it, keeping the connection's storage alive.
+        void forget_udp_session(const std::shared_ptr<connection<T>>& client) {
+            if (!udp_)
+                return;
+            std::scoped_lock lock(udp_sessions_mtx_);
+            auto it = udp_sessions_.find(client->get_id());
+            if (it != udp_sessions_.end() && it->second.lock() == client)
+                udp_sessions_.erase(it);
+        }
+
+        // Runs on the thread of the first io_context, which owns the UDP socket.
+        void on_udp_datagram(const asio::ip::udp::endpoint& sender, const udp_header& header, const uint8_t* payload, size_t size) {
+            std::shared_ptr<connection<T>> client;
+            {
+                std::scoped_lock lock(udp_sessions_mtx_);
+                auto it = udp_sessions_.find(header.session_id);
+                if (it == udp_sessions_.end())
+                    return;
+                client = it->second.lock();
+                if (!client) {
+                    udp_sessions_.erase(it);
+                    return;
+                }
+            }
+            if (!client->has_session_token(header.token) || !client->is_connected())
+                return;
+
+            // Bind request: remember where the client is and acknowledge it.
+            if (size == 0) {
+                client->bind_udp_endpoint(sender);
+                udp_->send_to(sender, header);
+                return;
+            }
+
+            message<T> msg;
+            if (!udp_channel<T>::decode(payload, size, msg) || !client->accept_udp_sequence(msg.header.id, header.sequence))
+                return;
+            // Dropped if the queue is full, like any datagram, rather than waited for on the I/O thread.
+            locate(client->get_id()).first.incoming_messages.try_push_back({ std::move(client), std::move(msg), std::chrono::steady_clock::now() });
+        }
+
+        static std::vector<std::unique_ptr<asio::io_context>> make_io_contexts(size_t thread_count) {
+            if (thread_count == 0)
+                thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+            std::vector<std::unique_ptr<asio::io_context>> contexts;
+            for (size_t i = 0; i < thread_count; i++)
+                contexts.emplace_back(std::make_unique<asio::io_context>(1));
+            return contexts;
+        }
+
+        size_t next_io_context_index() {
+            size_t index = next_context_index_;
+            next_context_index_ = (next_context_index_ + 1) % io_contexts_.size();
+            return index;
+        }
+
+        shard& next_shard() {
+            shard& s = *shards_[next_shard_index_];
+            next_shard_index_ = (next_shard_index_ + 1) % shards_.size();
+            return s;
+        }
+
     protected:
-        tsqueue<owned_message<T>> incoming_messages_;
-        std::deque<std::shared_ptr<connection<T>>> connections_;
-        asio::io_context context_;
-        std::thread ctx_thread_;
+        // One io_context per I/O thread; the acceptor lives on the first one.
+        // Declared first so that connections (and the messages referencing them) are destroyed before their contexts.
+        std::vector<std::unique_ptr<asio::io_context>> io_contexts_;
+        std::vector<asio::executor_work_guard<asio::io_context::executor_type>> work_guards_;
+        std::vector<std::thread> ctx_threads_;
+        size_t next_context_index_ = 0;
+        size_t next_shard_index_ = 0;
+        // Wakes update() when any shard's incoming queue gets a message.
+        doorbell incoming_doorbell_;
+        std::vector<std::unique_ptr<shard>> shards_;
+        std::unique_ptr<udp_channel<T>> udp_;
+        std::unordered_map<uint32_t, std::weak_ptr<connection<T>>> udp_sessions_;
+        std::mutex udp_sessions_mtx_;
+        spatial_grid<std::shared_ptr<connection<T>>> interest_grid_;
+        snapshot_batcher<T> snapshot_batcher_;
+        std::atomic<bool> ticking_ = false;
         asio::ip::tcp::acceptor asio_acceptor_;
-        uint32_t id_counter_ = 10000;
+        size_t compression_threshold_ = 0;
+        outgoing_limits outgoing_limits_;
+        size_t max_message_size_ = DEFAULT_MAX_MESSAGE_SIZE;
+        bool direct_receive_ = false;
+        static constexpr uint32_t HANDSHAKE_FAILURE_WEIGHT = 4;
+        std::chrono::steady_clock::duration resume_window_ {};
+        size_t replay_limit_ = 0;
+        std::unique_ptr<admission_controller> admission_;
+        // Message ids whose on_message runs on the I/O threads. Fixed once the server has started.
+        static constexpr size_t INLINE_ID_LIMIT = 256;
+        bool inline_all_ = false;
+        std::bitset<INLINE_ID_LIMIT> inline_ids_;
+        // Validated clients waiting for accept(), and the accept() waiting for them. I/O threads add to them.
+        std::deque<std::shared_ptr<connection<T>>> accepted_;
+        completion_slot<std::shared_ptr<connection<T>>> accept_waiter_;
+        std::mutex accepted_mtx_;
+        std::chrono::milliseconds keepalive_ {};
+        std::chrono::milliseconds idle_timeout_ {};
+        std::chrono::steady_clock::time_point heartbeat_epoch_;
+        std::vector<std::unique_ptr<heartbeat_wheel>> heartbeat_wheels_;
+        // One per io_context so each I/O thread records write latency without sharing cache lines.
+        std::vector<latency_histogram> write_latency_;
+        // Recorded by whichever thread runs update().
+        latency_histogram dispatch_latency_;
     };
 }
 
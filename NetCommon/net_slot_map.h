@@ -0,0 +1,140 @@
+#ifndef NETCLIENT_NET_SLOT_MAP_H
+#define NETCLIENT_NET_SLOT_MAP_H
+
+#include "net_common.h"
+#include <vector>
+
+namespace blcl::net {
+    // Generational handle into a slot_map: the low INDEX_BITS select a slot, the rest count how often it was reused.
+    // A handle whose slot has since been freed (and perhaps reused) no longer resolves, until the 12-bit generation
+    // wraps: after MAX_GENERATION more reuses of its slot, a stale handle resolves to that slot's value again.
+    // 0 is never a valid handle.
+    using slot_handle = uint32_t;
+
+    // Values in one dense array for iteration, addressed through a sparse slot array by generational handles.
+    // insert, erase and find are O(1); erase moves the last value into the hole, so iteration order is not stable.
+    // Not synchronized.
+    template <typename V>
+    class slot_map {
+    public:
+        static constexpr int INDEX_BITS = 20;
+        static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+        static constexpr size_t MAX_SIZE = INDEX_MASK;
+        static constexpr uint32_t MAX_GENERATION = ~0u >> INDEX_BITS;
+        static constexpr slot_handle INVALID = 0;
+
+        // Holds at most max_size values, itself at most MAX_SIZE.
+        explicit slot_map(size_t max_size = MAX_SIZE): max_size_(std::min(max_size, MAX_SIZE)) {
+
+        }
+
+        // Returns INVALID if all max_size slots are in use.
+        slot_handle insert(V value) {
+            uint32_t index;
+            if (free_head_ != NO_SLOT) {
+                index = free_head_;
+                free_head_ = slots_[index].dense;
+            } else if (slots_.size() < max_size_) {
+                index = uint32_t(slots_.size());
+                slots_.push_back({ NO_SLOT, 0 });
+            } else {
+                return INVALID;
+            }
+
+            slot& s = slots_[index];
+            // Generations skip 0 so that no live handle equals INVALID.
+            s.generation = (s.generation + 1) & MAX_GENERATION;
+            if (s.generation == 0)
+                s.generation = 1;
+            s.dense = uint32_t(values_.size());
+            values_.push_back(std::move(value));
+            owners_.push_back(index);
+            return slot_handle(s.generation) << INDEX_BITS | index;
+        }
+
+        V* find(slot_handle handle) {
+            slot* s = resolve(handle);
+            return s ? &values_[s->dense] : nullptr;
+        }
+
+        const V* find(slot_handle handle) const {
+            return const_cast<slot_map*>(this)->find(handle);
+        }
+
+        bool contains(slot_handle handle) const {
+            return const_cast<slot_map*>(this)->resolve(handle) != nullptr;
+        }
+
+        bool erase(slot_handle handle) {
+            slot* s = resolve(handle);
+            if (!s)
+                return false;
+
+            uint32_t hole = s->dense;
+            uint32_t last = uint32_t(values_.size() - 1);
+            if (hole != last) {
+                values_[hole] = std::move(values_[last]);
+                owners_[hole] = owners_[last];
+                slots_[owners_[hole]].dense = hole;
+            }
+            values_.pop_back();
+            owners_.pop_back();
+
+            // Freed slots are chained through their dense field.
+            uint32_t index = handle & INDEX_MASK;
+            s->dense = free_head_;
+            free_head_ = index;
+            return true;
+        }
+
+        // Handle of the value at position i of the dense array.
+        slot_handle handle_at(size_t i) const {
+            uint32_t index = owners_[i];
+            return slot_handle(slots_[index].generation) << INDEX_BITS | index;
+        }
+
+        V& operator[](size_t i) { return values_[i]; }
+        const V& operator[](size_t i) const { return values_[i]; }
+
+        auto begin() { return values_.begin(); }
+        auto end() { return values_.end(); }
+        auto begin() const { return values_.begin(); }
+        auto end() const { return values_.end(); }
+
+        size_t size() const {
+            return values_.size();
+        }
+
+        bool empty() const {
+            return values_.empty();
+        }
+
+    private:
+        static constexpr uint32_t NO_SLOT = ~0u;
+
+        struct slot {
+            // Position in values_ while occupied; next free slot while free.
+            uint32_t dense;
+            uint32_t generation;
+        };
+
+        slot* resolve(slot_handle handle) {
+            uint32_t index = handle & INDEX_MASK;
+            if (index >= slots_.size())
+                return nullptr;
+            slot& s = slots_[index];
+            if (s.generation != handle >> INDEX_BITS || s.dense >= values_.size() || owners_[s.dense] != index)
+                return nullptr;
+            return &s;
+        }
+
+        std::vector<slot> slots_;
+        std::vector<V> values_;
+        // Slot index of each value in values_, for fixing up the slot that points at a moved value.
+        std::vector<uint32_t> owners_;
+        uint32_t free_head_ = NO_SLOT;
+        size_t max_size_;
+    };
+}
+
+#endif //NETCLIENT_NET_SLOT_MAP_H
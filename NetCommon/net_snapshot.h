@@ -0,0 +1,186 @@
+#ifndef NETCLIENT_NET_SNAPSHOT_H
+#define NETCLIENT_NET_SNAPSHOT_H
+
+#include "net_common.h"
+#include "net_message.h"
+#include <unordered_map>
+#include <vector>
+
+namespace blcl::net {
+    // Collects per-client state updates during a tick, latest-wins, and packs them into snapshot messages.
+    // Snapshot body, front to back: uint32 count, then per entry uint32 client id, message_header<T>, body bytes.
+    template <typename T>
+    class snapshot_batcher {
+    public:
+        // One snapshot message of a flushed tick, and the IDs of the clients whose entries it holds, in order.
+        struct batch {
+            message<T> msg;
+            std::vector<uint32_t> client_ids;
+        };
+
+        void submit(uint32_t client_id, message<T>&& msg) {
+            auto& slot = index_[client_id];
+            if (slot.tick == tick_ && slot.index < entries_.size()) {
+                entries_[slot.index].second = std::move(msg);
+                return;
+            }
+            slot = { tick_, entries_.size() };
+            entries_.emplace_back(client_id, std::move(msg));
+        }
+
+        // Drops the index slot of a client that went away, along with whatever it submitted during this tick.
+        void forget(uint32_t client_id) {
+            auto it = index_.find(client_id);
+            if (it == index_.end())
+                return;
+            if (it->second.tick == tick_ && it->second.index < entries_.size()) {
+                // The last entry fills the hole; order within a tick carries no meaning.
+                size_t index = it->second.index;
+                if (index + 1 != entries_.size()) {
+                    entries_[index] = std::move(entries_.back());
+                    index_[entries_[index].first].index = index;
+                }
+                entries_.pop_back();
+            }
+            index_.erase(it);
+        }
+
+        bool empty() const {
+            return entries_.empty();
+        }
+
+        size_t size() const {
+            return entries_.size();
+        }
+
+        // Packs everything submitted since the last flush and starts a new tick. Entries go into as few snapshots as
+        // keeps each body within max_bytes; an entry too large for that on its own gets a snapshot to itself.
+        std::vector<batch> flush(T snapshot_id, size_t max_bytes = MAX_MSG_SIZE) {
+            std::vector<batch> batches;
+            size_t first = 0;
+            while (first < entries_.size()) {
+                size_t bytes = sizeof(uint32_t) + entry_size(entries_[first].second);
+                size_t last = first + 1;
+                for (; last < entries_.size(); last++) {
+                    size_t next = entry_size(entries_[last].second);
+                    if (bytes + next > max_bytes)
+                        break;
+                    bytes += next;
+                }
+                batches.push_back(pack(snapshot_id, first, last, bytes));
+                first = last;
+            }
+
+            entries_.clear();
+            tick_++;
+            return batches;
+        }
+
+        // A copy of snapshot without client_id's entry, for sending a batch back to one of the clients in it.
+        static message<T> without(const message<T>& snapshot, uint32_t client_id) {
+            message<T> copy;
+            copy.header = snapshot.header;
+            const uint8_t* begin = snapshot.body.data();
+            const uint8_t* in = begin;
+            const uint8_t* end = in + snapshot.body.size();
+            uint32_t count = 0;
+            if (!get(in, end, &count, sizeof(count)))
+                return copy;
+
+            for (uint32_t i = 0; i < count; i++) {
+                const uint8_t* entry = in;
+                uint32_t id = 0;
+                message_header<T> header;
+                if (!get(in, end, &id, sizeof(id)) || !get(in, end, &header, sizeof(message_header<T>)) || size_t(end - in) < header.size)
+                    break;
+                in += header.size;
+                if (id != client_id)
+                    continue;
+
+                copy.body.reserve(snapshot.body.size() - (in - entry));
+                copy.body.insert(copy.body.end(), begin, entry);
+                copy.body.insert(copy.body.end(), in, end);
+                count--;
+                std::memcpy(copy.body.data(), &count, sizeof(count));
+                copy.header.size = copy.size();
+                return copy;
+            }
+            copy.body = snapshot.body;
+            return copy;
+        }
+
+        // Calls fn(client_id, msg) for every entry of a snapshot produced by flush(). Returns false if it is malformed.
+        template <typename Fn>
+        static bool read(const message<T>& snapshot, Fn&& fn) {
+            const uint8_t* in = snapshot.body.data();
+            const uint8_t* end = in + snapshot.body.size();
+            uint32_t count = 0;
+            if (!get(in, end, &count, sizeof(count)))
+                return false;
+
+            message<T> msg;
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t id = 0;
+                if (!get(in, end, &id, sizeof(id)) || !get(in, end, &msg.header, sizeof(message_header<T>)))
+                    return false;
+                if (size_t(end - in) < msg.header.size)
+                    return false;
+                msg.body.assign(in, in + msg.header.size);
+                in += msg.header.size;
+                fn(id, msg);
+            }
+            return true;
+        }
+
+    private:
+        static size_t entry_size(const message<T>& msg) {
+            return sizeof(uint32_t) + sizeof(message_header<T>) + msg.body.size();
+        }
+
+        // Packs entries_[first, last), whose snapshot body comes to bytes.
+        batch pack(T snapshot_id, size_t first, size_t last, size_t bytes) const {
+            batch b;
+            b.msg.header.id = snapshot_id;
+            b.msg.body.resize(bytes);
+            b.client_ids.reserve(last - first);
+            uint8_t* out = b.msg.body.data();
+            uint32_t count = uint32_t(last - first);
+            out = put(out, &count, sizeof(count));
+            for (size_t i = first; i < last; i++) {
+                const auto& [id, msg] = entries_[i];
+                out = put(out, &id, sizeof(id));
+                out = put(out, &msg.header, sizeof(message_header<T>));
+                out = put(out, msg.body.data(), msg.body.size());
+                b.client_ids.push_back(id);
+            }
+            b.msg.header.size = b.msg.size();
+            return b;
+        }
+
+        static uint8_t* put(uint8_t* out, const void* data, size_t size) {
+            if (size > 0)
+                std::memcpy(out, data, size);
+            return out + size;
+        }
+
+        static bool get(const uint8_t*& in, const uint8_t* end, void* data, size_t size) {
+            if (size_t(end - in) < size)
+                return false;
+            std::memcpy(data, in, size);
+            in += size;
+            return true;
+        }
+
+        // The index outlives ticks; a slot only counts if it was written during the current one.
+        struct slot {
+            uint64_t tick = 0;
+            size_t index = 0;
+        };
+
+        std::unordered_map<uint32_t, slot> index_;
+        std::vector<std::pair<uint32_t, message<T>>> entries_;
+        uint64_t tick_ = 1;
+    };
+}
+
+#endif //NETCLIENT_NET_SNAPSHOT_H
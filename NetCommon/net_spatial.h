@@ -0,0 +1,158 @@
+#ifndef NETCLIENT_NET_SPATIAL_H
+#define NETCLIENT_NET_SPATIAL_H
+
+#include "net_common.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace blcl::net {
+    struct vec3 {
+        float x = 0;
+        float y = 0;
+        float z = 0;
+    };
+
+    // Uniform grid over 3D positions for interest management.
+    // Each cell keeps its entries in a dense vector, so a range query walks contiguous memory;
+    // moving an entry within its cell is a store, moving it across cells is a swap-remove plus a push.
+    template <typename Value>
+    class spatial_grid {
+    public:
+        explicit spatial_grid(float cell_size = 64.0f): cell_size_(cell_size) {
+
+        }
+
+        // Inserts key at pos, or moves it there if it is already indexed. Positions come off the network, so one
+        // with a NaN or infinite coordinate is turned away: false, and the grid is left as it was.
+        bool update(uint32_t key, const Value& value, const vec3& pos) {
+            if (!is_finite(pos))
+                return false;
+            uint64_t cell = cell_of(pos);
+            auto it = entries_.find(key);
+            if (it != entries_.end()) {
+                if (it->second.cell == cell) {
+                    cells_[cell][it->second.index].pos = pos;
+                    return true;
+                }
+                erase_slot(it->second);
+                entries_.erase(it);
+            }
+
+            auto& slots = cells_[cell];
+            entries_[key] = { cell, slots.size() };
+            slots.push_back({ pos, key, value });
+            return true;
+        }
+
+        void remove(uint32_t key) {
+            auto it = entries_.find(key);
+            if (it == entries_.end())
+                return;
+            erase_slot(it->second);
+            entries_.erase(it);
+        }
+
+        bool contains(uint32_t key) const {
+            return entries_.count(key) != 0;
+        }
+
+        size_t size() const {
+            return entries_.size();
+        }
+
+        // Calls fn(key, value, pos) for every entry within radius of origin. An infinite radius finds every entry;
+        // a NaN radius or origin finds none.
+        template <typename Fn>
+        void query(const vec3& origin, float radius, Fn&& fn) const {
+            if (!is_finite(origin) || std::isnan(radius))
+                return;
+            float radius_sq = radius * radius;
+            auto visit = [&](const std::vector<slot>& slots) {
+                for (const auto& s: slots) {
+                    float dx = s.pos.x - origin.x, dy = s.pos.y - origin.y, dz = s.pos.z - origin.z;
+                    if (dx * dx + dy * dy + dz * dz <= radius_sq)
+                        fn(s.key, s.value, s.pos);
+                }
+            };
+
+            int64_t x0 = coord(origin.x - radius), x1 = coord(origin.x + radius);
+            int64_t y0 = coord(origin.y - radius), y1 = coord(origin.y + radius);
+            int64_t z0 = coord(origin.z - radius), z1 = coord(origin.z + radius);
+            // A radius spanning more cells than are occupied is cheaper to answer by scanning the occupied ones.
+            // Counted in double, which a radius of up to COORD_LIMIT cells per axis can't overflow.
+            if (double(x1 - x0 + 1) * double(y1 - y0 + 1) * double(z1 - z0 + 1) > double(cells_.size())) {
+                for (const auto& [cell, slots]: cells_)
+                    visit(slots);
+                return;
+            }
+
+            for (int64_t x = x0; x <= x1; x++)
+                for (int64_t y = y0; y <= y1; y++)
+                    for (int64_t z = z0; z <= z1; z++) {
+                        auto it = cells_.find(pack(x, y, z));
+                        if (it != cells_.end())
+                            visit(it->second);
+                    }
+        }
+
+        void clear() {
+            entries_.clear();
+            cells_.clear();
+        }
+
+    private:
+        struct slot {
+            vec3 pos;
+            uint32_t key;
+            Value value;
+        };
+
+        struct location {
+            uint64_t cell;
+            size_t index;
+        };
+
+        // Clamped, so that a huge or infinite v doesn't overflow the conversion. v must not be NaN.
+        int64_t coord(float v) const {
+            double c = std::floor(double(v) / cell_size_);
+            return int64_t(std::clamp(c, -double(COORD_LIMIT), double(COORD_LIMIT)));
+        }
+
+        static bool is_finite(const vec3& v) {
+            return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+        }
+
+        // 21 bits per axis, which covers +-1M cells.
+        static uint64_t pack(int64_t x, int64_t y, int64_t z) {
+            constexpr uint64_t MASK = (uint64_t(1) << 21) - 1;
+            return (uint64_t(x) & MASK) << 42 | (uint64_t(y) & MASK) << 21 | (uint64_t(z) & MASK);
+        }
+
+        uint64_t cell_of(const vec3& pos) const {
+            return pack(coord(pos.x), coord(pos.y), coord(pos.z));
+        }
+
+        void erase_slot(const location& loc) {
+            auto cell_it = cells_.find(loc.cell);
+            auto& slots = cell_it->second;
+            if (loc.index != slots.size() - 1) {
+                slots[loc.index] = std::move(slots.back());
+                entries_[slots[loc.index].key].index = loc.index;
+            }
+            slots.pop_back();
+            if (slots.empty())
+                cells_.erase(cell_it);
+        }
+
+        // Well past the +-1M cells pack() tells apart, and far enough from the int64 range that spans of it don't overflow.
+        static constexpr int64_t COORD_LIMIT = int64_t(1) << 40;
+
+        float cell_size_;
+        std::unordered_map<uint32_t, location> entries_;
+        std::unordered_map<uint64_t, std::vector<slot>> cells_;
+    };
+}
+
+#endif //NETCLIENT_NET_SPATIAL_H
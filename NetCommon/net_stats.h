@@ -0,0 +1,229 @@
+#ifndef NETCLIENT_NET_STATS_H
+#define NETCLIENT_NET_STATS_H
+
+#include "net_common.h"
+#include "net_message.h"
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <sstream>
+
+namespace blcl::net {
+    // Point-in-time copy of a latency_histogram; values are nanoseconds.
+    struct histogram_snapshot {
+        static constexpr int SUB_BUCKET_BITS = 3;
+        static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static constexpr int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        std::array<uint64_t, BUCKETS> counts {};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        static int index_of(uint64_t value) {
+            if (value < SUB_BUCKETS)
+                return int(value);
+            int shift = (63 - std::countl_zero(value)) - SUB_BUCKET_BITS;
+            return (shift + 1) * SUB_BUCKETS + int((value >> shift) & (SUB_BUCKETS - 1));
+        }
+
+        // Largest value that lands in the same bucket as index.
+        static uint64_t highest_of(int index) {
+            if (index < SUB_BUCKETS)
+                return uint64_t(index);
+            int shift = index / SUB_BUCKETS - 1;
+            uint64_t lowest = uint64_t(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+            return lowest + (uint64_t(1) << shift) - 1;
+        }
+
+        // Value at quantile q (0..1), accurate to the bucket width (1/8 of its power of two).
+        uint64_t percentile(double q) const {
+            if (count == 0)
+                return 0;
+            uint64_t rank = std::max<uint64_t>(1, uint64_t(q * double(count) + 0.5));
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKETS; i++) {
+                seen += counts[i];
+                if (seen >= rank)
+                    return std::min(highest_of(i), max);
+            }
+            return max;
+        }
+
+        double mean() const {
+            return count ? double(sum) / double(count) : 0.0;
+        }
+
+        void merge(const histogram_snapshot& other) {
+            for (int i = 0; i < BUCKETS; i++)
+                counts[i] += other.counts[i];
+            count += other.count;
+            sum += other.sum;
+            max = std::max(max, other.max);
+        }
+    };
+
+    // HDR-style log-linear histogram of nanosecond durations: 8 linear sub-buckets per power of two.
+    // Recording is a couple of relaxed atomic adds; give each writing thread its own instance to keep it uncontended.
+    class latency_histogram {
+    public:
+        void record(uint64_t ns) {
+            counts_[histogram_snapshot::index_of(ns)].fetch_add(1, std::memory_order_relaxed);
+            sum_.fetch_add(ns, std::memory_order_relaxed);
+            uint64_t max = max_.load(std::memory_order_relaxed);
+            while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) { }
+        }
+
+        void record(std::chrono::steady_clock::duration elapsed) {
+            record(uint64_t(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())));
+        }
+
+        histogram_snapshot snapshot() const {
+            histogram_snapshot out;
+            for (int i = 0; i < histogram_snapshot::BUCKETS; i++) {
+                out.counts[i] = counts_[i].load(std::memory_order_relaxed);
+                out.count += out.counts[i];
+            }
+            out.sum = sum_.load(std::memory_order_relaxed);
+            out.max = max_.load(std::memory_order_relaxed);
+            return out;
+        }
+
+    private:
+        std::array<std::atomic<uint64_t>, histogram_snapshot::BUCKETS> counts_ {};
+        std::atomic<uint64_t> sum_ { 0 };
+        std::atomic<uint64_t> max_ { 0 };
+    };
+
+    // Outgoing traffic of one priority lane.
+    struct lane_stats {
+        uint64_t messages_out = 0;
+        uint64_t bytes_out = 0;
+        size_t queue_depth = 0;
+
+        void merge(const lane_stats& other) {
+            messages_out += other.messages_out;
+            bytes_out += other.bytes_out;
+            queue_depth += other.queue_depth;
+        }
+    };
+
+    // Counters of one connection. Bytes and messages count whole frames, header included.
+    struct connection_stats {
+        uint64_t writes = 0;
+        uint64_t messages_out = 0;
+        uint64_t bytes_out = 0;
+        uint64_t messages_in = 0;
+        uint64_t bytes_in = 0;
+        size_t outgoing_queue_depth = 0;
+        // Messages an overflow policy discarded or replaced, and their frame bytes.
+        uint64_t dropped_messages = 0;
+        uint64_t dropped_bytes = 0;
+        // Indexed by priority.
+        std::array<lane_stats, PRIORITY_LANES> lanes {};
+
+        double messages_per_write() const {
+            return writes ? double(messages_out) / double(writes) : 0.0;
+        }
+
+        void merge(const connection_stats& other) {
+            writes += other.writes;
+            messages_out += other.messages_out;
+            bytes_out += other.bytes_out;
+            messages_in += other.messages_in;
+            bytes_in += other.bytes_in;
+            outgoing_queue_depth += other.outgoing_queue_depth;
+            dropped_messages += other.dropped_messages;
+            dropped_bytes += other.dropped_bytes;
+            for (size_t i = 0; i < PRIORITY_LANES; i++)
+                lanes[i].merge(other.lanes[i]);
+        }
+    };
+
+    // What server_interface::get_stats() reports. Totals include connections that have since gone away.
+    struct server_stats {
+        size_t connections = 0;
+        connection_stats totals;
+        size_t incoming_queue_depth = 0;
+        size_t max_outgoing_queue_depth = 0;
+        // From async_write to its completion handler.
+        histogram_snapshot write_latency;
+        // From the socket read that completed a message to on_message being called with it.
+        histogram_snapshot dispatch_latency;
+
+        std::string to_text() const {
+            std::ostringstream out;
+            out << "connections " << connections << "\n"
+                << "bytes_in " << totals.bytes_in << "\n"
+                << "bytes_out " << totals.bytes_out << "\n"
+                << "messages_in " << totals.messages_in << "\n"
+                << "messages_out " << totals.messages_out << "\n"
+                << "writes " << totals.writes << "\n"
+                << "incoming_queue_depth " << incoming_queue_depth << "\n"
+                << "outgoing_queue_depth " << totals.outgoing_queue_depth << "\n"
+                << "max_outgoing_queue_depth " << max_outgoing_queue_depth << "\n"
+                << "dropped_messages " << totals.dropped_messages << "\n"
+                << "dropped_bytes " << totals.dropped_bytes << "\n";
+            for (size_t i = 0; i < PRIORITY_LANES; i++) {
+                const lane_stats& lane = totals.lanes[i];
+                out << "lane_" << LANE_NAMES[i] << " messages_out=" << lane.messages_out << " bytes_out=" << lane.bytes_out
+                    << " queue_depth=" << lane.queue_depth << "\n";
+            }
+            text_histogram(out, "write_latency_ns", write_latency);
+            text_histogram(out, "dispatch_latency_ns", dispatch_latency);
+            return out.str();
+        }
+
+        std::string to_json() const {
+            std::ostringstream out;
+            out << "{\"connections\":" << connections
+                << ",\"bytes_in\":" << totals.bytes_in
+                << ",\"bytes_out\":" << totals.bytes_out
+                << ",\"messages_in\":" << totals.messages_in
+                << ",\"messages_out\":" << totals.messages_out
+                << ",\"writes\":" << totals.writes
+                << ",\"incoming_queue_depth\":" << incoming_queue_depth
+                << ",\"outgoing_queue_depth\":" << totals.outgoing_queue_depth
+                << ",\"max_outgoing_queue_depth\":" << max_outgoing_queue_depth
+                << ",\"dropped_messages\":" << totals.dropped_messages
+                << ",\"dropped_bytes\":" << totals.dropped_bytes
+                << ",\"lanes\":{";
+            for (size_t i = 0; i < PRIORITY_LANES; i++) {
+                const lane_stats& lane = totals.lanes[i];
+                out << (i ? "," : "") << "\"" << LANE_NAMES[i] << "\":{\"messages_out\":" << lane.messages_out
+                    << ",\"bytes_out\":" << lane.bytes_out << ",\"queue_depth\":" << lane.queue_depth << "}";
+            }
+            out << "}"
+                << ",\"write_latency_ns\":";
+            json_histogram(out, write_latency);
+            out << ",\"dispatch_latency_ns\":";
+            json_histogram(out, dispatch_latency);
+            out << "}\n";
+            return out.str();
+        }
+
+    private:
+        static constexpr const char* LANE_NAMES[PRIORITY_LANES] = { "high", "normal", "bulk" };
+
+        static constexpr std::pair<const char*, double> QUANTILES[] = {
+            { "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "p999", 0.999 }
+        };
+
+        static void text_histogram(std::ostringstream& out, const char* name, const histogram_snapshot& h) {
+            out << name << " count=" << h.count << " mean=" << uint64_t(h.mean());
+            for (const auto& [label, q]: QUANTILES)
+                out << " " << label << "=" << h.percentile(q);
+            out << " max=" << h.max << "\n";
+        }
+
+        static void json_histogram(std::ostringstream& out, const histogram_snapshot& h) {
+            out << "{\"count\":" << h.count << ",\"mean\":" << uint64_t(h.mean());
+            for (const auto& [label, q]: QUANTILES)
+                out << ",\"" << label << "\":" << h.percentile(q);
+            out << ",\"max\":" << h.max << "}";
+        }
+    };
+}
+
+#endif //NETCLIENT_NET_STATS_H
@@ -0,0 +1,94 @@
+#ifndef NETCLIENT_NET_TIMER_WHEEL_H
+#define NETCLIENT_NET_TIMER_WHEEL_H
+
+#include "net_common.h"
+#include <array>
+#include <vector>
+
+namespace blcl::net {
+    // Hierarchical timer wheel over integer ticks: LEVELS wheels of 64 slots, each level's slot spanning 64 times
+    // the ticks of the level below. Scheduling is O(1); advancing costs O(1) per tick plus the entries that fire or
+    // move down a level. Entries can't be cancelled: have the callback check whether the entry is still wanted.
+    // Deadlines further out than the wheel reaches fire early, at its horizon. Not synchronized.
+    template <typename Entry>
+    class timer_wheel {
+    public:
+        static constexpr int SLOT_BITS = 6;
+        static constexpr uint64_t SLOTS = 1 << SLOT_BITS;
+        static constexpr int LEVELS = 4;
+        static constexpr uint64_t HORIZON = uint64_t(1) << (SLOT_BITS * LEVELS);
+
+        explicit timer_wheel(uint64_t now = 0): now_(now) {
+
+        }
+
+        // Fires entry at the first advance() to tick or later; a tick that has already passed means the next one.
+        void schedule(uint64_t tick, Entry entry) {
+            tick = std::clamp(tick, now_ + 1, now_ + HORIZON - 1);
+            place(tick, std::move(entry));
+            size_++;
+        }
+
+        // Moves time forward to now, calling fn(Entry&&) for every entry that came due, in tick order.
+        // fn may schedule() more entries.
+        template <typename Fn>
+        void advance(uint64_t now, Fn&& fn) {
+            while (now_ < now) {
+                now_++;
+                // Whenever a level wraps, spread the next slot of the level above over it.
+                for (int level = 1; level < LEVELS && (now_ & mask(level)) == 0; level++)
+                    cascade(level);
+
+                auto& due = slots_[0][now_ & (SLOTS - 1)];
+                if (due.empty())
+                    continue;
+                firing_.swap(due);
+                size_ -= firing_.size();
+                for (auto& [tick, entry]: firing_)
+                    fn(std::move(entry));
+                firing_.clear();
+            }
+        }
+
+        uint64_t now() const {
+            return now_;
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+    private:
+        static constexpr uint64_t mask(int level) {
+            return (uint64_t(1) << (SLOT_BITS * level)) - 1;
+        }
+
+        // The lowest level whose span covers the distance, in the slot the deadline falls into on that level.
+        void place(uint64_t tick, Entry&& entry) {
+            uint64_t distance = tick - now_;
+            int level = 0;
+            while (level < LEVELS - 1 && distance >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+                level++;
+            slots_[level][(tick >> (SLOT_BITS * level)) & (SLOTS - 1)].emplace_back(tick, std::move(entry));
+        }
+
+        void cascade(int level) {
+            auto& slot = slots_[level][(now_ >> (SLOT_BITS * level)) & (SLOTS - 1)];
+            if (slot.empty())
+                return;
+            cascading_.swap(slot);
+            for (auto& [tick, entry]: cascading_)
+                place(std::max(tick, now_), std::move(entry));
+            cascading_.clear();
+        }
+
+        uint64_t now_;
+        size_t size_ = 0;
+        std::array<std::array<std::vector<std::pair<uint64_t, Entry>>, SLOTS>, LEVELS> slots_;
+        // Scratch for the slot being fired or cascaded, kept to reuse its capacity.
+        std::vector<std::pair<uint64_t, Entry>> firing_;
+        std::vector<std::pair<uint64_t, Entry>> cascading_;
+    };
+}
+
+#endif //NETCLIENT_NET_TIMER_WHEEL_H
@@ -3,16 +3,16 @@
 #include "net_common.h"
 
 namespace blcl::net {
-    template <typename T>
+    template <typename T, typename Allocator = std::allocator<T>>
     class tsqueue {
     public:
         tsqueue() = default;
-        tsqueue(const tsqueue<T>&) = delete; // explicitly delete copy constructor
+        tsqueue(const tsqueue&) = delete; // explicitly delete copy constructor
         virtual ~tsqueue() { clear(); }
 
     protected:
         std::mutex queue_mtx_;
-        std::deque<T> raw_deque_;
+        std::deque<T, Allocator> raw_deque_;
         std::condition_variable to_update_cv_;
         std::mutex to_update_mtx_;
 
@@ -28,6 +28,14 @@ namespace blcl::net {
         }
 
         void push_front(const T& item) {
+            std::scoped_lock lock(queue_mtx_);
+            raw_deque_.emplace_front(item);
+
+            std::unique_lock<std::mutex> lk(to_update_mtx_);
+            to_update_cv_.notify_one();
+        }
+
+        void push_front(T&& item) {
             std::scoped_lock lock(queue_mtx_);
             raw_deque_.emplace_front(std::move(item));
 
@@ -36,6 +44,14 @@ namespace blcl::net {
         }
 
         void push_back(const T& item) {
+            std::scoped_lock lock(queue_mtx_);
+            raw_deque_.emplace_back(item);
+
+            std::unique_lock<std::mutex> lk(to_update_mtx_);
+            to_update_cv_.notify_one();
+        }
+
+        void push_back(T&& item) {
             std::scoped_lock lock(queue_mtx_);
             raw_deque_.emplace_back(std::move(item));
 
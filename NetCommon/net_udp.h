@@ -0,0 +1,141 @@
+#ifndef NETCLIENT_NET_UDP_H
+#define NETCLIENT_NET_UDP_H
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_handshake.h"
+#include <array>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <unordered_map>
+
+namespace blcl::net {
+    // Prefix of every datagram. A datagram with nothing after it is a bind request (client) or bind ack (server).
+    struct udp_header {
+        uint32_t session_id = 0;
+        uint32_t sequence = 0;
+        uint64_t token = 0;
+    };
+
+    // Keeps datagrams latest-wins: per message id, anything not newer than what was already delivered is stale.
+    template <typename T>
+    class udp_sequence_filter {
+    public:
+        bool accept(T id, uint32_t sequence) {
+            auto [it, inserted] = latest_.try_emplace(uint32_t(id), sequence);
+            if (inserted)
+                return true;
+            if (int32_t(sequence - it->second) <= 0)
+                return false;
+            it->second = sequence;
+            return true;
+        }
+
+        void reset() {
+            latest_.clear();
+        }
+
+    private:
+        std::unordered_map<uint32_t, uint32_t> latest_;
+    };
+
+    // One UDP socket with a receive loop, used by the server for all sessions and by the client for its own.
+    template <typename T>
+    class udp_channel {
+    public:
+        // Datagrams above this are sent over TCP instead, to stay clear of IP fragmentation.
+        static constexpr size_t MAX_DATAGRAM_SIZE = 1200;
+
+        using receive_handler = std::function<void(const asio::ip::udp::endpoint&, const udp_header&, const uint8_t*, size_t)>;
+
+        udp_channel(asio::io_context& context, const asio::ip::udp::endpoint& local_endpoint, receive_handler handler)
+            : socket_(context, local_endpoint), handler_(std::move(handler))
+        {
+            // Unreliable sends never block; if the kernel buffer is full the datagram is simply dropped.
+            socket_.non_blocking(true);
+        }
+
+        void start() {
+            receive();
+        }
+
+        void close() {
+            asio::post(socket_.get_executor(), [this]() { socket_.close(); });
+        }
+
+        asio::ip::udp::endpoint local_endpoint() const {
+            return socket_.local_endpoint();
+        }
+
+        // Drops the given fraction of datagrams in both directions, for exercising loss handling over loopback.
+        void set_simulated_loss(double rate) {
+            loss_ppm_.store(uint32_t(std::clamp(rate, 0.0, 1.0) * 1e6), std::memory_order_relaxed);
+        }
+
+        static bool fits(const message<T>& msg) {
+            return sizeof(udp_header) + sizeof(message_header<T>) + msg.body.size() <= MAX_DATAGRAM_SIZE;
+        }
+
+        // Safe to call from any thread; sends on the socket are serialized. Returns false if the datagram was dropped.
+        bool send_to(const asio::ip::udp::endpoint& endpoint, const udp_header& header, const message<T>* msg = nullptr) {
+            if (simulate_loss())
+                return false;
+
+            std::array<asio::const_buffer, 3> buffers = {
+                asio::buffer(&header, sizeof(udp_header)),
+                msg ? asio::buffer(&msg->header, sizeof(message_header<T>)) : asio::const_buffer(),
+                msg ? asio::buffer(msg->body.data(), msg->body.size()) : asio::const_buffer()
+            };
+            asio::error_code ec;
+            // The socket is non-blocking, so this is held for one syscall at most.
+            std::scoped_lock lock(send_mtx_);
+            socket_.send_to(buffers, endpoint, 0, ec);
+            return !ec;
+        }
+
+        // Decodes the message following the udp_header of a datagram.
+        static bool decode(const uint8_t* payload, size_t size, message<T>& msg) {
+            if (size < sizeof(message_header<T>))
+                return false;
+            std::memcpy(&msg.header, payload, sizeof(message_header<T>));
+            if (msg.header.size != size - sizeof(message_header<T>))
+                return false;
+            msg.body.assign(payload + sizeof(message_header<T>), payload + size);
+            return true;
+        }
+
+    private:
+        // async
+        void receive() {
+            socket_.async_receive_from(asio::buffer(recv_buffer_), sender_,
+                make_pooled_handler([this](asio::error_code ec, std::size_t length) {
+                    if (ec == asio::error::operation_aborted || !socket_.is_open())
+                        return;
+                    if (!ec && length >= sizeof(udp_header) && !simulate_loss()) {
+                        udp_header header;
+                        std::memcpy(&header, recv_buffer_.data(), sizeof(udp_header));
+                        handler_(sender_, header, recv_buffer_.data() + sizeof(udp_header), length - sizeof(udp_header));
+                    }
+                    receive();
+            }));
+        }
+
+        bool simulate_loss() {
+            uint32_t loss_ppm = loss_ppm_.load(std::memory_order_relaxed);
+            if (loss_ppm == 0)
+                return false;
+            thread_local std::minstd_rand rng(std::random_device{}());
+            return rng() % 1000000 < loss_ppm;
+        }
+
+        asio::ip::udp::socket socket_;
+        std::mutex send_mtx_;
+        std::array<uint8_t, MAX_DATAGRAM_SIZE> recv_buffer_ {};
+        asio::ip::udp::endpoint sender_;
+        receive_handler handler_;
+        std::atomic<uint32_t> loss_ppm_ { 0 };
+    };
+}
+
+#endif //NETCLIENT_NET_UDP_H
@@ -1,41 +1,33 @@
 #include <iostream>
 #include <blcl_net.h>
-#include <unordered_map>
 
 enum class MsgType: uint32_t {
     ServerAccept,
     ServerDeny,
     ServerPing,
     MessageAll,
-    ServerMessage
+    ServerMessage,
+    ServerSnapshot
 };
 
 class CustomServer: public blcl::net::server_interface<MsgType> {
 private:
-    std::unordered_map<std::string, uint64_t> fail2ban_counter_;
-    uint64_t max_fail_attempt = 10;
-    bool is_banned(const std::shared_ptr<blcl::net::connection<MsgType>>& client) {
-        if (fail2ban_counter_[client->get_endpoint().address().to_string()] > max_fail_attempt)
-            return true;
-
-        ++fail2ban_counter_[client->get_endpoint().address().to_string()];
-        return false;
-    }
+    double since_stats_dump_ = 0;
 
 public:
     CustomServer(uint16_t port) : blcl::net::server_interface<MsgType>(port) {
 
     }
 
+    ~CustomServer() override {
+        stop();
+    }
+
 protected:
     bool on_client_connect(std::shared_ptr<blcl::net::connection<MsgType>> client) override {
-        if (is_banned(client)) {
-            return false;
-        }
-
         blcl::net::message<MsgType> msg;
         msg.header.id = MsgType::ServerAccept;
-        client->send(msg);
+        client->send(std::move(msg), blcl::net::priority::high);
 
         return true;
     }
@@ -44,31 +36,50 @@ protected:
         std::cout << "[INFO] Client " << client->get_id() << " has been disconnected." << std::endl;
     }
 
+    void on_tick(double dt) override {
+        // Refresh the stats file every few seconds; `watch cat server_stats.json` to follow it.
+        since_stats_dump_ += dt;
+        if (since_stats_dump_ >= 5.0) {
+            since_stats_dump_ = 0;
+            dump_stats("server_stats.json");
+        }
+    }
+
     void on_message(std::shared_ptr<blcl::net::connection<MsgType>> client, blcl::net::message<MsgType>& msg) override {
         switch (msg.header.id) {
             case MsgType::ServerPing: {
                 //std::cout << "[INFO] " << client->get_id() << ": Server Ping" << std::endl;
-                client->send(msg);
+                // Pings measure round-trip time; don't let them queue behind snapshots.
+                client->send(std::move(msg), blcl::net::priority::high);
                 break;
             }
             case MsgType::MessageAll: {
                // std::cout << "[INFO] [" << std::chrono::system_clock::now().time_since_epoch().count() << "] " << client->get_id() << ": Broadcast\n";
-//                blcl::net::message<MsgType> msg;
                 msg.header.id = MsgType::ServerMessage;
-                msg << client->get_id();
-                broadcast_message(msg, client);
+                queue_state_update(client, std::move(msg));
+                break;
             }
+            default:
+                break;
         }
     }
 };
 
 int main() {
     CustomServer server(60000);
+    // Addresses that connect more than 10 times in about a minute are turned away at accept.
+    server.set_admission_limit(10, std::chrono::minutes(1));
+    server.enable_heartbeat(std::chrono::seconds(5), std::chrono::seconds(15));
+    // A client that drops and reconnects within 30 s keeps its ID and gets what it missed instead of resyncing.
+    server.enable_session_resumption(std::chrono::seconds(30));
+    // A client that can't keep up loses its oldest messages rather than building an ever-growing backlog.
+    // Not coalesce: a tick's snapshot can take several ServerSnapshot messages, each with other clients' states.
+    server.set_outgoing_limits({ 0, 1024 * 1024, blcl::net::overflow_policy::drop_oldest, 512 * 1024 });
+    // The ping echo only sends, so it can skip the hop to the tick thread; state updates must stay on it.
+    server.enable_inline_dispatch(MsgType::ServerPing);
     server.start();
 
-    while (1) {
-        server.update();
-    }
+    server.run_ticks(30, MsgType::ServerSnapshot);
 
     return 0;
 }